@@ -0,0 +1,123 @@
+#include "audio_device.hpp"
+
+#include "realtime.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+void check_status(pj_status_t status, const char *what) {
+  if (status != PJ_SUCCESS) {
+    char errmsg[PJ_ERR_MSG_SIZE];
+    pj_strerror(status, errmsg, sizeof(errmsg));
+    throw std::runtime_error(std::string(what) + ": " + errmsg);
+  }
+}
+} // namespace
+
+AudioDevice::AudioDevice(int capture_dev, int playback_dev,
+                         bool main_device) {
+  pjsua_conf_port_info master_info;
+  check_status(pjsua_conf_get_port_info(0, &master_info),
+               "Getting conference bridge format");
+  auto clock_rate = master_info.clock_rate;
+  auto channel_count = master_info.channel_count;
+  auto samples_per_frame = master_info.samples_per_frame;
+  auto bits_per_sample = master_info.bits_per_sample;
+
+  m_pool = pjsua_pool_create("auddev", 512, 512);
+  m_frame_bytes = samples_per_frame * bits_per_sample / 8;
+  m_sidetone.emplace(clock_rate, samples_per_frame / channel_count);
+
+  if (main_device) {
+    m_downstream = pjsua_set_no_snd_dev();
+    auto &mgr = pj::Endpoint::instance().audDevManager();
+    m_capture = &mgr.getCaptureDevMedia();
+    m_playback = &mgr.getPlaybackDevMedia();
+  } else {
+    pjmedia_port *rev_port = nullptr;
+    check_status(pjmedia_splitcomb_create(m_pool, clock_rate, channel_count,
+                                          samples_per_frame, bits_per_sample,
+                                          0, &m_downstream),
+                 "Creating splitcomb");
+    check_status(pjmedia_splitcomb_create_rev_channel(m_pool, m_downstream, 0,
+                                                      0, &rev_port),
+                 "Creating splitcomb channel");
+    m_bridge_port.add(rev_port, m_pool);
+    m_capture = &m_bridge_port;
+    m_playback = &m_bridge_port;
+  }
+
+  pj_str_t name = pj_str(const_cast<char *>("payphone-device"));
+  pjmedia_port_info_init(&m_device_port.info, &name,
+                         PJMEDIA_SIG_CLASS_APP('P', 'D'), clock_rate,
+                         channel_count, bits_per_sample, samples_per_frame);
+  m_device_port.port_data.pdata = this;
+  m_device_port.get_frame = &AudioDevice::on_get_frame;
+  m_device_port.put_frame = &AudioDevice::on_put_frame;
+
+  check_status(pjmedia_snd_port_create(m_pool, capture_dev, playback_dev,
+                                       clock_rate, channel_count,
+                                       samples_per_frame, bits_per_sample, 0,
+                                       &m_snd_port),
+               "Opening sound device");
+  check_status(pjmedia_snd_port_connect(m_snd_port, &m_device_port),
+               "Connecting sound device");
+}
+
+AudioDevice::~AudioDevice() {
+  if (m_snd_port) {
+    pjmedia_snd_port_disconnect(m_snd_port);
+    pjmedia_snd_port_destroy(m_snd_port);
+  }
+  if (m_playback == &m_bridge_port) {
+    m_bridge_port.remove();
+    pjmedia_port_destroy(m_downstream);
+  }
+  pj_pool_release(m_pool);
+}
+
+// Playback: the device wants a frame to play.
+pj_status_t AudioDevice::on_get_frame(pjmedia_port *port,
+                                      pjmedia_frame *frame) {
+  Realtime::instance().enter_media_thread();
+  auto self = static_cast<AudioDevice *>(port->port_data.pdata);
+  auto status = pjmedia_port_get_frame(self->m_downstream, frame);
+  if (status == PJ_SUCCESS) {
+    process_playback(frame, self->m_frame_bytes, self->m_loud,
+                     *self->m_sidetone);
+  }
+  return status;
+}
+
+void AudioDevice::process_playback(pjmedia_frame *frame, size_t frame_bytes,
+                                   LoudGain &loud,
+                                   Sidetone &sidetone) noexcept {
+  // No call, or a silent far end: the talker should still hear themselves.
+  if (frame->type == PJMEDIA_FRAME_TYPE_NONE) {
+    std::memset(frame->buf, 0, frame_bytes);
+    frame->size = frame_bytes;
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+  }
+  if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO) {
+    return;
+  }
+  auto samples = static_cast<int16_t *>(frame->buf);
+  auto count = frame->size / sizeof(int16_t);
+  loud.process(samples, count);
+  // After the gain, so the loud button doesn't make the talker louder.
+  sidetone.mix(samples, count);
+}
+
+// Capture: the device has a frame of microphone audio.
+pj_status_t AudioDevice::on_put_frame(pjmedia_port *port,
+                                      pjmedia_frame *frame) {
+  Realtime::instance().enter_media_thread();
+  auto self = static_cast<AudioDevice *>(port->port_data.pdata);
+  if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO) {
+    self->m_sidetone->capture(static_cast<const int16_t *>(frame->buf),
+                              frame->size / sizeof(int16_t));
+  }
+  return pjmedia_port_put_frame(self->m_downstream, frame);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "gain.hpp"
+#include "sidetone.hpp"
+
+#include <optional>
+
+#include <pjsua2.hpp>
+
+// A sound device owned by a single handset. The device's callbacks run
+// through a small pass-through port that sits between the sound device and
+// the conference bridge, which gives us a place to work on the raw frames at
+// the device without adding a bridge hop.
+//
+// The main device takes over the bridge's master port (slot 0), exactly as
+// pjsua would have. Every other device gets its own bridge slot through a
+// splitter/combiner, the same way pjsua's extra sound devices are wired.
+class AudioDevice {
+public:
+  AudioDevice(int capture_dev, int playback_dev, bool main_device);
+  ~AudioDevice();
+
+  AudioDevice(const AudioDevice &) = delete;
+  AudioDevice &operator=(const AudioDevice &) = delete;
+
+  pj::AudioMedia &capture() noexcept { return *m_capture; }
+  pj::AudioMedia &playback() noexcept { return *m_playback; }
+
+  // Boosts the earpiece for the loud button. Applied to the frames on their
+  // way to the device, so toggling it doesn't touch any bridge connections.
+  void set_loud(bool loud) noexcept { m_loud.set_enabled(loud); }
+  bool loud() const noexcept { return m_loud.enabled(); }
+
+  // Level of the microphone mixed back into the earpiece, in dB.
+  void set_sidetone_level(float level_db) noexcept {
+    m_sidetone->set_level(level_db);
+  }
+
+  // The playback side of the device callback, after the bridge has filled
+  // frame: a frame the bridge had nothing for becomes frame_bytes of
+  // silence, so the sidetone still plays into it, then the loud gain and
+  // the sidetone are applied.
+  static void process_playback(pjmedia_frame *frame, size_t frame_bytes,
+                               LoudGain &loud, Sidetone &sidetone) noexcept;
+
+private:
+  class BridgePort : public pj::AudioMedia {
+  public:
+    ~BridgePort() { remove(); }
+
+    void add(pjmedia_port *port, pj_pool_t *pool) {
+      registerMediaPort2(port, pool);
+    }
+    void remove() { unregisterMediaPort(); }
+  };
+
+  static pj_status_t on_get_frame(pjmedia_port *port, pjmedia_frame *frame);
+  static pj_status_t on_put_frame(pjmedia_port *port, pjmedia_frame *frame);
+
+  pj_pool_t *m_pool = nullptr;
+  size_t m_frame_bytes = 0;
+  pjmedia_port m_device_port = {};
+  pjmedia_port *m_downstream = nullptr;
+  pjmedia_snd_port *m_snd_port = nullptr;
+  BridgePort m_bridge_port;
+  pj::AudioMedia *m_capture = nullptr;
+  pj::AudioMedia *m_playback = nullptr;
+  LoudGain m_loud;
+  std::optional<Sidetone> m_sidetone;
+};
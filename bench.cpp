@@ -0,0 +1,272 @@
+#include "dialer.hpp"
+#include "fake_gpio.hpp"
+#include "gpio.hpp"
+#include "line.hpp"
+#include "yaml_persisted_obj.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <pjsua2.hpp>
+#include <yaml-cpp/yaml.h>
+
+// Microbenchmarks for the hot paths outside of pjsip. Prints one JSON object
+// per benchmark on stdout, so runs can be diffed from commit to commit:
+//
+//   {"name":"gpio_line_values/set_test","iterations":...,"ns_per_op":...,
+//    "min_ns_per_op":...}
+//
+//   bench [FILTER]
+//
+// runs only the benchmarks whose name contains FILTER. ns_per_op is the
+// median of five batches, each sized to take about 50ms.
+namespace {
+using Clock = std::chrono::steady_clock;
+
+template <typename T> void keep(const T &value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+std::string filter;
+
+template <typename Fn> void bench(const std::string &name, Fn &&fn) {
+  if (name.find(filter) == std::string::npos) {
+    return;
+  }
+  auto time_batch = [&](uint64_t iterations) {
+    auto begin = Clock::now();
+    for (uint64_t idx = 0; idx < iterations; ++idx) {
+      fn();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - begin)
+        .count();
+  };
+
+  uint64_t iterations = 1;
+  double elapsed_ns;
+  while ((elapsed_ns = time_batch(iterations)) < 1e7) {
+    iterations *= 2;
+  }
+  iterations = std::max<uint64_t>(1, iterations * 5e7 / elapsed_ns);
+
+  std::vector<double> per_op;
+  for (int batch = 0; batch < 5; ++batch) {
+    per_op.push_back(time_batch(iterations) / iterations);
+  }
+  std::sort(per_op.begin(), per_op.end());
+  std::cout << "{\"name\":\"" << name << "\",\"iterations\":" << iterations
+            << ",\"ns_per_op\":" << per_op[2]
+            << ",\"min_ns_per_op\":" << per_op[0] << "}" << std::endl;
+}
+
+void skipped(const std::string &name, const std::string &why) {
+  if (name.find(filter) != std::string::npos) {
+    std::cout << "{\"name\":\"" << name << "\",\"skipped\":\"" << why
+              << "\"}" << std::endl;
+  }
+}
+
+class ChipAccess : public GpioChip {
+public:
+  using GpioChip::line_config_to_ioctl;
+};
+
+std::vector<std::string> line_names() {
+  std::vector<std::string> names;
+  for (int idx = 0; idx < 28; ++idx) {
+    names.push_back("GPIO" + std::to_string(idx));
+  }
+  return names;
+}
+
+// FakeGpioChip for everything but reads, which return the same canned
+// events every time, so only the decoding is measured.
+class CannedEvents : public GpioBackend {
+public:
+  CannedEvents(FakeGpioChip &chip, size_t count) : m_chip(chip) {
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      gpio_v2_line_event event = {};
+      event.timestamp_ns = 1000000 * (idx + 1);
+      event.id = idx % 2 ? GPIO_V2_LINE_EVENT_RISING_EDGE
+                         : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+      event.offset = idx % 7;
+      event.seqno = idx + 1;
+      event.line_seqno = idx / 7 + 1;
+      m_events.push_back(event);
+    }
+  }
+
+  int open(const std::filesystem::path &path) override {
+    return m_chip.open(path);
+  }
+  int close(int fd) override { return m_chip.close(fd); }
+  int ioctl(int fd, unsigned long ctl, void *arg) override {
+    return m_chip.ioctl(fd, ctl, arg);
+  }
+  ssize_t read(int, void *buf, size_t len) override {
+    len = std::min(len, m_events.size() * sizeof(gpio_v2_line_event));
+    std::memcpy(buf, m_events.data(), len);
+    return len;
+  }
+
+private:
+  FakeGpioChip &m_chip;
+  std::vector<gpio_v2_line_event> m_events;
+};
+
+// Plays the same events back forever.
+class ScriptedDialer : public Dialer {
+public:
+  explicit ScriptedDialer(std::vector<Event> script)
+      : m_script(std::move(script)) {}
+
+  void interrupt() override {}
+
+  EventData wait_for_event(std::optional<std::chrono::microseconds>) override {
+    auto event = m_script[m_next];
+    m_next = (m_next + 1) % m_script.size();
+    return EventData(event);
+  }
+
+private:
+  std::vector<Event> m_script;
+  size_t m_next = 0;
+};
+
+void bench_gpio() {
+  for (size_t attr_count : {0, 3, 10}) {
+    GpioChip::LineConfig config;
+    config.flags.flags = GpioLineFlags::Input | GpioLineFlags::EdgeFalling;
+    for (uint32_t idx = 0; idx < attr_count; ++idx) {
+      GpioLineValues mask{idx};
+      switch (idx % 3) {
+      case 0:
+        config.attrs.emplace_back(
+            mask, GpioDebouncePeriod{std::chrono::microseconds{5000}});
+        break;
+      case 1:
+        config.attrs.emplace_back(mask, GpioLineValues{idx});
+        break;
+      default:
+        config.attrs.emplace_back(mask,
+                                  GpioLineFlags{GpioLineFlags::Output});
+      }
+    }
+    bench("line_config_to_ioctl/" + std::to_string(attr_count), [&] {
+      gpio_v2_line_config out = {};
+      ChipAccess::line_config_to_ioctl(config, &out);
+      keep(out);
+    });
+  }
+
+  FakeGpioChip fake("gpiochip0", line_names());
+  for (size_t count : {1, 16, 64}) {
+    CannedEvents canned(fake, count);
+    GpioChip chip("/dev/gpiochip0", &canned);
+    GpioChip::LineConfig config;
+    config.flags.flags = GpioLineFlags::Input | GpioLineFlags::EdgeRising |
+                         GpioLineFlags::EdgeFalling;
+    auto source = chip.make_line_event_source({0, 1, 2, 3, 4, 5, 6}, "bench",
+                                              std::move(config), 64);
+    std::vector<GpioLineEventData> out(64);
+    bench("read_events/" + std::to_string(count), [&] {
+      keep(source.read_events(out.data(), out.size()));
+    });
+  }
+
+  bench("gpio_line_values/construct", [] {
+    GpioLineValues values{0, 1, 2, 3, 4, 5, 6};
+    keep(values);
+  });
+  bench("gpio_line_values/set_test", [] {
+    GpioLineValues values;
+    for (int idx = 0; idx < 64; ++idx) {
+      values.set(idx, idx % 3 != 0);
+    }
+    int count = 0;
+    for (int idx = 0; idx < 64; ++idx) {
+      count += values.test(idx);
+    }
+    keep(count);
+  });
+  GpioLineValues lhs{1, 3, 5}, rhs{1, 3, 6};
+  bench("gpio_line_values/compare", [&] {
+    keep(lhs == rhs);
+    keep(lhs != rhs);
+  });
+}
+
+// An account with count proxies and count credentials.
+YAML::Node account_config(size_t count) {
+  std::ostringstream out;
+  out << "idUri: \"sip:6001@192.168.1.249\"\n"
+      << "AccountRegConfig:\n"
+      << "  registrarUri: \"sip:192.168.1.249\"\n"
+      << "  registerOnAdd: true\n"
+      << "AccountSipConfig:\n"
+      << "  proxies:\n";
+  for (size_t idx = 0; idx < count; ++idx) {
+    out << "    - \"sip:proxy" << idx << ".example.com;lr\"\n";
+  }
+  out << "  authCreds:\n";
+  for (size_t idx = 0; idx < count; ++idx) {
+    out << "    - { scheme: \"digest\", realm: \"realm" << idx
+        << "\", username: \"6001\", dataType: 0, data: \"s3cret\" }\n";
+  }
+  return YAML::Load(out.str());
+}
+
+void bench_yaml() {
+  bench("get_defaults/AccountConfig",
+        [] { keep(get_defaults<pj::AccountConfig>()); });
+  bench("get_defaults/TransportConfig",
+        [] { keep(get_defaults<pj::TransportConfig>()); });
+  bench("get_defaults/EpConfig", [] { keep(get_defaults<pj::EpConfig>()); });
+
+  for (size_t count : {1, 10, 100}) {
+    auto node = account_config(count);
+    bench("yaml_account_config/" + std::to_string(count), [&] {
+      keep(read_config_object<pj::AccountConfig>(node, "AccountConfig"));
+    });
+  }
+}
+
+// Off hook to dial tone, then on hook, again and again. Each step is one
+// pass of the state machine.
+void bench_line_step() {
+  pj::Endpoint ep;
+  ep.libCreate();
+  pj::EpConfig ep_config;
+  ep_config.logConfig.level = 0;
+  ep_config.logConfig.consoleLevel = 0;
+  ep.libInit(ep_config);
+  ep.libStart();
+  try {
+    Line line("bench",
+              std::make_unique<ScriptedDialer>(std::vector<Dialer::Event>{
+                  Dialer::Event::OffHook, Dialer::Event::OnHook}),
+              std::make_unique<AudioDevice>(PJMEDIA_AUD_DEFAULT_CAPTURE_DEV,
+                                            PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV,
+                                            true));
+    bench("line_step/off_hook_on_hook", [&] { line.step(); });
+  } catch (const std::exception &e) {
+    skipped("line_step/off_hook_on_hook", e.what());
+  }
+  ep.libDestroy();
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    filter = argv[1];
+  }
+  bench_gpio();
+  bench_yaml();
+  bench_line_step();
+  return 0;
+}
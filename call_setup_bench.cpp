@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <pjsua2.hpp>
+
+// Times call setup, INVITE to 200 OK, against sip_stub on loopback. Run the
+// stub with --invite 200, and --loss to drop UDP datagrams; for TCP loss
+// use netem, e.g. tc qdisc add dev lo root netem loss 5%.
+//
+//   call_setup_bench [--transport udp|tcp] [--port 5070] [--calls 50]
+//
+// Over TCP the connection is opened by REGISTER, so every call goes out on
+// a warm one, and a lost segment costs a TCP retransmit rather than SIP's
+// 500ms timer. To compare the two under the same 5% loss:
+//
+//   tc qdisc add dev lo root netem loss 5%
+//   sip_stub --port 5070 --invite 200 &
+//   call_setup_bench --transport udp
+//   call_setup_bench --transport tcp
+//   tc qdisc del dev lo root
+namespace {
+template <typename Pred>
+bool wait_for(std::mutex &mutex, std::condition_variable &cond, Pred pred) {
+  std::unique_lock<std::mutex> lk(mutex);
+  return cond.wait_for(lk, std::chrono::seconds{40}, pred);
+}
+
+class BenchAccount : public pj::Account {
+public:
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool registered = false;
+
+  void onRegState(pj::OnRegStateParam &) override {
+    auto active = getInfo().regIsActive;
+    std::lock_guard<std::mutex> lk(mutex);
+    registered = active;
+    cond.notify_all();
+  }
+};
+
+class BenchCall : public pj::Call {
+public:
+  using pj::Call::Call;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  pjsip_inv_state state = PJSIP_INV_STATE_NULL;
+
+  void onCallState(pj::OnCallStateParam &) override {
+    auto ci = getInfo();
+    std::lock_guard<std::mutex> lk(mutex);
+    state = ci.state;
+    cond.notify_all();
+  }
+};
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string transport = "udp";
+  int port = 5070;
+  int calls = 50;
+  for (int idx = 1; idx + 1 < argc; idx += 2) {
+    std::string arg = argv[idx];
+    if (arg == "--transport") {
+      transport = argv[idx + 1];
+    } else if (arg == "--port") {
+      port = std::atoi(argv[idx + 1]);
+    } else if (arg == "--calls") {
+      calls = std::atoi(argv[idx + 1]);
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      return 2;
+    }
+  }
+  auto type = transport == "tcp" ? PJSIP_TRANSPORT_TCP : PJSIP_TRANSPORT_UDP;
+  auto target = "127.0.0.1:" + std::to_string(port) + ";transport=" + transport;
+
+  pj::Endpoint ep;
+  ep.libCreate();
+  pj::EpConfig ep_config;
+  ep_config.logConfig.level = 1;
+  ep_config.logConfig.consoleLevel = 1;
+  ep.libInit(ep_config);
+  pjsip_cfg()->tcp.keep_alive_interval = 15;
+  pj::TransportConfig tc;
+  auto transport_id = ep.transportCreate(type, tc);
+  ep.libStart();
+  ep.audDevManager().setNullDev();
+
+  pj::AccountConfig ac;
+  ac.idUri = "sip:bench@127.0.0.1";
+  ac.regConfig.registrarUri = "sip:" + target;
+  ac.sipConfig.transportId = transport_id;
+  BenchAccount account;
+  account.create(ac);
+  if (!wait_for(account.mutex, account.cond,
+                [&] { return account.registered; })) {
+    std::cerr << "no registration" << std::endl;
+    return 1;
+  }
+
+  std::vector<double> setup_ms;
+  int failed = 0;
+  for (int idx = 0; idx < calls; ++idx) {
+    auto call = std::make_unique<BenchCall>(account);
+    pj::CallOpParam prm(true);
+    prm.opt.audioCount = 1;
+    prm.opt.videoCount = 0;
+    auto begin = std::chrono::steady_clock::now();
+    call->makeCall("sip:echo@" + target, prm);
+    wait_for(call->mutex, call->cond, [&] {
+      return call->state == PJSIP_INV_STATE_CONFIRMED ||
+             call->state == PJSIP_INV_STATE_DISCONNECTED;
+    });
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    if (call->state == PJSIP_INV_STATE_CONFIRMED) {
+      setup_ms.push_back(
+          std::chrono::duration<double, std::milli>(elapsed).count());
+      pj::CallOpParam hangup_prm;
+      call->hangup(hangup_prm);
+    } else {
+      ++failed;
+    }
+    wait_for(call->mutex, call->cond, [&] {
+      return call->state == PJSIP_INV_STATE_DISCONNECTED;
+    });
+  }
+
+  std::sort(setup_ms.begin(), setup_ms.end());
+  auto pct = [&](double fraction) {
+    return setup_ms.empty() ? 0.0 : setup_ms[(setup_ms.size() - 1) * fraction];
+  };
+  std::cout << transport << ": " << setup_ms.size() << " calls, " << failed
+            << " failed, setup p50 " << pct(0.5) << "ms, p90 " << pct(0.9)
+            << "ms, max " << pct(1.0) << "ms" << std::endl;
+  ep.libDestroy();
+  return 0;
+}
@@ -0,0 +1,217 @@
+#include "cdr.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+constexpr char magic[8] = {'P', 'A', 'Y', 'C', 'D', 'R', '\0', '\1'};
+constexpr size_t page_size = 4096;
+
+struct Header {
+  char magic[8];
+  uint64_t capacity;
+};
+
+struct Layout {
+  size_t commit, start, answer, end, status, direction, hangup_by, number;
+  size_t total;
+};
+
+Layout layout(size_t capacity) {
+  Layout l;
+  size_t offset = page_size;
+  auto column = [&](size_t entry_size) {
+    auto ret = offset;
+    offset += (capacity * entry_size + page_size - 1) / page_size * page_size;
+    return ret;
+  };
+  l.commit = column(sizeof(uint32_t));
+  l.start = column(sizeof(int64_t));
+  l.answer = column(sizeof(int64_t));
+  l.end = column(sizeof(int64_t));
+  l.status = column(sizeof(uint16_t));
+  l.direction = column(sizeof(uint8_t));
+  l.hangup_by = column(sizeof(uint8_t));
+  l.number = column(CallRecord::number_size);
+  l.total = offset;
+  return l;
+}
+
+int64_t to_ns(std::chrono::system_clock::time_point tp) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             tp.time_since_epoch())
+      .count();
+}
+
+void throw_errno(const std::string &what) {
+  int err = errno;
+  throw std::system_error(err, std::system_category(), what);
+}
+} // namespace
+
+CdrFile::CdrFile(const std::filesystem::path &path, bool writable,
+                 size_t capacity) {
+  int flags = writable ? O_RDWR | O_CREAT : O_RDONLY;
+  int fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    throw_errno("Could not open " + path.string());
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) == -1) {
+    ::close(fd);
+    throw_errno("Could not stat " + path.string());
+  }
+  Header header;
+  if (st.st_size == 0 && writable) {
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.capacity = capacity;
+    // Allocate every block up front so a full disk can't turn a store into
+    // the mapping into a SIGBUS later.
+    int err = ::posix_fallocate(fd, 0, layout(capacity).total);
+    if (err == 0 && ::pwrite(fd, &header, sizeof(header), 0) == -1) {
+      err = errno;
+    }
+    if (err != 0) {
+      ::close(fd);
+      ::unlink(path.c_str());
+      throw std::system_error(err, std::system_category(),
+                              "Could not allocate " + path.string());
+    }
+  } else if (::pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+             std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+             static_cast<uint64_t>(st.st_size) <
+                 layout(header.capacity).total) {
+    ::close(fd);
+    throw std::runtime_error(path.string() + " is not a call detail log");
+  }
+
+  m_capacity = header.capacity;
+  auto l = layout(m_capacity);
+  m_map_size = l.total;
+  m_map = ::mmap(nullptr, m_map_size,
+                 writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                 writable ? MAP_SHARED | MAP_POPULATE : MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (m_map == MAP_FAILED) {
+    throw_errno("Could not map " + path.string());
+  }
+
+  auto base = static_cast<uint8_t *>(m_map);
+  m_commit = reinterpret_cast<uint32_t *>(base + l.commit);
+  m_start = reinterpret_cast<int64_t *>(base + l.start);
+  m_answer = reinterpret_cast<int64_t *>(base + l.answer);
+  m_end = reinterpret_cast<int64_t *>(base + l.end);
+  m_status = reinterpret_cast<uint16_t *>(base + l.status);
+  m_direction = base + l.direction;
+  m_hangup_by = base + l.hangup_by;
+  m_number = reinterpret_cast<char *>(base + l.number);
+}
+
+CdrFile::~CdrFile() { ::munmap(m_map, m_map_size); }
+
+std::string_view CdrFile::number(size_t idx) const noexcept {
+  auto number = m_number + idx * CallRecord::number_size;
+  return {number, strnlen(number, CallRecord::number_size)};
+}
+
+// FNV-1a over every field, never 0 so that 0 can mean an empty slot.
+uint32_t CdrFile::checksum(size_t idx) const noexcept {
+  uint32_t hash = 2166136261u;
+  auto mix = [&](const void *data, size_t len) {
+    auto bytes = static_cast<const uint8_t *>(data);
+    for (size_t pos = 0; pos < len; ++pos) {
+      hash = (hash ^ bytes[pos]) * 16777619u;
+    }
+  };
+  mix(&m_start[idx], sizeof(int64_t));
+  mix(&m_answer[idx], sizeof(int64_t));
+  mix(&m_end[idx], sizeof(int64_t));
+  mix(&m_status[idx], sizeof(uint16_t));
+  mix(&m_direction[idx], 1);
+  mix(&m_hangup_by[idx], 1);
+  mix(m_number + idx * CallRecord::number_size, CallRecord::number_size);
+  return hash == 0 ? 1 : hash;
+}
+
+bool CdrFile::committed(size_t idx) const noexcept {
+  auto marker = __atomic_load_n(&m_commit[idx], __ATOMIC_ACQUIRE);
+  return marker != 0 && marker == checksum(idx);
+}
+
+size_t CdrFile::find_end() const noexcept {
+  size_t end = m_capacity;
+  while (end != 0 &&
+         __atomic_load_n(&m_commit[end - 1], __ATOMIC_ACQUIRE) == 0) {
+    --end;
+  }
+  return end;
+}
+
+CdrLog::CdrLog(const std::filesystem::path &path, size_t capacity)
+    : CdrFile(path, true, capacity) {
+  // Appends resume after the last committed slot. Slots a crash left taken
+  // but uncommitted before it stay holes; any after it are reused, which is
+  // safe because append() rewrites every field before committing.
+  m_next.store(find_end(), std::memory_order_relaxed);
+}
+
+bool CdrLog::append(const CallRecord &record) noexcept {
+  auto idx = m_next.fetch_add(1, std::memory_order_relaxed);
+  if (idx >= m_capacity) {
+    m_next.store(m_capacity, std::memory_order_relaxed);
+    Metrics::instance().cdr_dropped.add();
+    return false;
+  }
+
+  m_start[idx] = to_ns(record.start);
+  m_answer[idx] = to_ns(record.answer);
+  m_end[idx] = to_ns(record.end);
+  m_status[idx] = record.status;
+  m_direction[idx] = static_cast<uint8_t>(record.direction);
+  m_hangup_by[idx] = static_cast<uint8_t>(record.hangup_by);
+  auto number = m_number + idx * CallRecord::number_size;
+  auto len = std::min(record.number.size(), CallRecord::number_size);
+  std::memcpy(number, record.number.data(), len);
+  std::memset(number + len, 0, CallRecord::number_size - len);
+  __atomic_store_n(&m_commit[idx], checksum(idx), __ATOMIC_RELEASE);
+  return true;
+}
+
+size_t CdrLog::size() const noexcept {
+  return std::min(m_next.load(std::memory_order_relaxed), m_capacity);
+}
+
+CdrReader::CdrReader(const std::filesystem::path &path)
+    : CdrFile(path, false, 0) {}
+
+void CdrReader::scan(std::chrono::system_clock::time_point from,
+                     std::chrono::system_clock::time_point to,
+                     std::string_view prefix,
+                     const std::function<void(size_t)> &fn) const {
+  auto from_ns = to_ns(from);
+  auto until_ns = to_ns(to);
+  prefix = prefix.substr(0, CallRecord::number_size);
+  auto end = find_end();
+  for (size_t idx = 0; idx < end; ++idx) {
+    // Cheapest test first; most queries are narrow in time.
+    if (m_start[idx] < from_ns || m_start[idx] >= until_ns) {
+      continue;
+    }
+    if (std::memcmp(m_number + idx * CallRecord::number_size, prefix.data(),
+                    prefix.size()) != 0) {
+      continue;
+    }
+    if (committed(idx)) {
+      fn(idx);
+    }
+  }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string_view>
+
+// One call, as kept in the call detail record log.
+struct CallRecord {
+  enum class Direction : uint8_t { Outgoing, Incoming };
+  enum class HangupBy : uint8_t { Unknown, Local, Remote };
+
+  constexpr static size_t number_size = 24;
+
+  Direction direction = Direction::Outgoing;
+  HangupBy hangup_by = HangupBy::Unknown;
+  // Truncated to number_size.
+  std::string_view number;
+  std::chrono::system_clock::time_point start;
+  // The epoch if the call was never answered.
+  std::chrono::system_clock::time_point answer;
+  std::chrono::system_clock::time_point end;
+  // Final pjsip_status_code.
+  uint16_t status = 0;
+};
+
+// The file is a header page followed by one page aligned column per field,
+// each capacity entries long, so a query only reads the columns it filters
+// on. Records are never moved or rewritten; each one is made visible by
+// storing its commit marker, a checksum of the record, after everything else.
+// A record torn by a crash has a marker that doesn't match and is skipped.
+class CdrFile {
+public:
+  ~CdrFile();
+  CdrFile(const CdrFile &) = delete;
+  CdrFile &operator=(const CdrFile &) = delete;
+
+  size_t capacity() const noexcept { return m_capacity; }
+
+  // Whether there is a complete record at idx.
+  bool committed(size_t idx) const noexcept;
+
+  int64_t start_ns(size_t idx) const noexcept { return m_start[idx]; }
+  int64_t answer_ns(size_t idx) const noexcept { return m_answer[idx]; }
+  int64_t end_ns(size_t idx) const noexcept { return m_end[idx]; }
+  uint16_t status(size_t idx) const noexcept { return m_status[idx]; }
+  CallRecord::Direction direction(size_t idx) const noexcept {
+    return static_cast<CallRecord::Direction>(m_direction[idx]);
+  }
+  CallRecord::HangupBy hangup_by(size_t idx) const noexcept {
+    return static_cast<CallRecord::HangupBy>(m_hangup_by[idx]);
+  }
+  std::string_view number(size_t idx) const noexcept;
+
+protected:
+  CdrFile(const std::filesystem::path &path, bool writable, size_t capacity);
+
+  uint32_t checksum(size_t idx) const noexcept;
+  // One past the last slot that has been written to.
+  size_t find_end() const noexcept;
+
+  size_t m_capacity = 0;
+  void *m_map = nullptr;
+  size_t m_map_size = 0;
+
+  uint32_t *m_commit;
+  int64_t *m_start;
+  int64_t *m_answer;
+  int64_t *m_end;
+  uint16_t *m_status;
+  uint8_t *m_direction;
+  uint8_t *m_hangup_by;
+  char *m_number;
+};
+
+// Appends records to a pre-allocated, memory mapped log. Appending is a
+// handful of stores into the mapping, with no system calls; the kernel writes
+// the pages back. Safe to append from several threads at once.
+class CdrLog : public CdrFile {
+public:
+  // Creates the file with room for capacity records if it doesn't exist,
+  // otherwise appends after the last record in it.
+  CdrLog(const std::filesystem::path &path, size_t capacity);
+
+  // Returns false, and counts payphone_cdr_dropped_total, if the log is full.
+  bool append(const CallRecord &record) noexcept;
+
+  size_t size() const noexcept;
+
+private:
+  std::atomic<size_t> m_next{0};
+};
+
+// Read only view of a log, for queries. Records appended while it is open
+// show up as they are committed.
+class CdrReader : public CdrFile {
+public:
+  explicit CdrReader(const std::filesystem::path &path);
+
+  // Calls fn with the index of every committed record that started in
+  // [from, to) and whose number starts with prefix, in log order.
+  void scan(std::chrono::system_clock::time_point from,
+            std::chrono::system_clock::time_point to, std::string_view prefix,
+            const std::function<void(size_t)> &fn) const;
+};
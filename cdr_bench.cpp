@@ -0,0 +1,79 @@
+#include "cdr.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// Fills a call detail log with a few million calls, five minutes apart on
+// average, and times appending them and querying them back by time range and
+// by number prefix.
+//
+//   cdr_bench [records] [file]
+int main(int argc, char **argv) {
+  size_t num_records = argc > 1 ? std::atoll(argv[1]) : 4000000;
+  std::filesystem::path path = argc > 2 ? argv[2] : "/tmp/cdr_bench.cdr";
+  std::filesystem::remove(path);
+
+  using Clock = std::chrono::steady_clock;
+  auto begin = Clock::now();
+  CdrLog log(path, num_records);
+  auto opened = Clock::now();
+
+  auto first_call = std::chrono::system_clock::from_time_t(1500000000);
+  std::string number = "+15550000000";
+  uint32_t rng = 1;
+  for (size_t idx = 0; idx < num_records; ++idx) {
+    rng = rng * 1664525 + 1013904223;
+    auto start = first_call + std::chrono::seconds{idx * 300 + rng % 60};
+    auto digits = std::to_string(rng % 10000000);
+    number.replace(number.size() - digits.size(), digits.size(), digits);
+    CallRecord record;
+    record.direction = rng & 1 ? CallRecord::Direction::Incoming
+                               : CallRecord::Direction::Outgoing;
+    record.hangup_by = rng & 2 ? CallRecord::HangupBy::Remote
+                               : CallRecord::HangupBy::Local;
+    record.number = number;
+    record.start = start;
+    record.answer = start + std::chrono::seconds{5};
+    record.end = start + std::chrono::seconds{60 + rng % 600};
+    record.status = 200;
+    log.append(record);
+  }
+  auto appended = Clock::now();
+
+  auto time_scan = [&](std::chrono::system_clock::time_point from,
+                       std::chrono::system_clock::time_point to,
+                       std::string_view prefix) {
+    CdrReader reader(path);
+    size_t matches = 0;
+    auto start = Clock::now();
+    reader.scan(from, to, prefix, [&](size_t) { ++matches; });
+    auto elapsed = Clock::now() - start;
+    std::cout << "  " << matches << " matches in "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+                     .count()
+              << "us\n";
+  };
+
+  auto us = [](Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  };
+  std::cout << num_records << " records, "
+            << std::filesystem::file_size(path) / (1024 * 1024) << "MB\n"
+            << "create " << us(opened - begin) << "us\n"
+            << "append mean "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(appended -
+                                                                    opened)
+                       .count() /
+                   num_records
+            << "ns\n"
+            << "one day:\n";
+  auto mid = first_call + std::chrono::minutes{num_records / 2 * 5};
+  time_scan(mid, mid + std::chrono::hours{24}, "");
+  std::cout << "prefix +1555123:\n";
+  time_scan({}, std::chrono::system_clock::time_point::max(), "+1555123");
+  std::cout << "everything:\n";
+  time_scan({}, std::chrono::system_clock::time_point::max(), "");
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include "cdr.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+
+// Prints the calls in a call detail log as CSV.
+//
+//   cdr_query <file> [--from TIME] [--to TIME] [--prefix NUMBER] [--count]
+//
+// TIME is seconds since the epoch or local "YYYY-MM-DD[ HH:MM[:SS]]".
+namespace {
+std::optional<std::chrono::system_clock::time_point>
+parse_time(const char *str) {
+  char *end;
+  auto seconds = std::strtoll(str, &end, 10);
+  if (*end == '\0') {
+    return std::chrono::system_clock::from_time_t(seconds);
+  }
+  for (auto format : {"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"}) {
+    std::tm tm = {};
+    auto rest = strptime(str, format, &tm);
+    if (rest && *rest == '\0') {
+      tm.tm_isdst = -1;
+      return std::chrono::system_clock::from_time_t(std::mktime(&tm));
+    }
+  }
+  return std::nullopt;
+}
+
+void print_time(int64_t ns) {
+  if (ns == 0) {
+    return;
+  }
+  std::time_t seconds = ns / 1000000000;
+  char buf[32];
+  std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S",
+                std::localtime(&seconds));
+  std::cout << buf << '.' << std::setw(3) << std::setfill('0')
+            << ns / 1000000 % 1000;
+}
+
+int usage() {
+  std::cerr << "usage: cdr_query <file> [--from TIME] [--to TIME] "
+               "[--prefix NUMBER] [--count]"
+            << std::endl;
+  return 2;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    return usage();
+  }
+  std::chrono::system_clock::time_point from;
+  auto to = std::chrono::system_clock::time_point::max();
+  std::string prefix;
+  bool count_only = false;
+  for (int idx = 2; idx < argc; ++idx) {
+    std::string arg = argv[idx];
+    if (arg == "--count") {
+      count_only = true;
+      continue;
+    }
+    if (idx + 1 == argc) {
+      return usage();
+    }
+    auto value = argv[++idx];
+    if (arg == "--prefix") {
+      prefix = value;
+    } else if (arg == "--from" || arg == "--to") {
+      auto time = parse_time(value);
+      if (!time) {
+        std::cerr << "bad time " << value << std::endl;
+        return usage();
+      }
+      (arg == "--from" ? from : to) = *time;
+    } else {
+      return usage();
+    }
+  }
+
+  try {
+    CdrReader reader(argv[1]);
+    size_t count = 0;
+    if (!count_only) {
+      std::cout << "start,answer,end,direction,number,status,hangup\n";
+    }
+    reader.scan(from, to, prefix, [&](size_t idx) {
+      ++count;
+      if (count_only) {
+        return;
+      }
+      print_time(reader.start_ns(idx));
+      std::cout << ',';
+      print_time(reader.answer_ns(idx));
+      std::cout << ',';
+      print_time(reader.end_ns(idx));
+      std::cout << ','
+                << (reader.direction(idx) == CallRecord::Direction::Incoming
+                        ? "in"
+                        : "out")
+                << ',' << reader.number(idx) << ',' << reader.status(idx)
+                << ',';
+      switch (reader.hangup_by(idx)) {
+      case CallRecord::HangupBy::Local:
+        std::cout << "local";
+        break;
+      case CallRecord::HangupBy::Remote:
+        std::cout << "remote";
+        break;
+      case CallRecord::HangupBy::Unknown:
+        break;
+      }
+      std::cout << '\n';
+    });
+    if (count_only) {
+      std::cout << count << std::endl;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,87 @@
+#include "debounce.hpp"
+
+namespace {
+// Calls fn with the index of every set bit in mask, lowest first.
+template <typename Fn> void for_each_bit(uint64_t mask, Fn &&fn) {
+  while (mask != 0) {
+    fn(static_cast<uint32_t>(__builtin_ctzll(mask)));
+    mask &= mask - 1;
+  }
+}
+} // namespace
+
+void Debouncer::set_window(GpioLineValues lines,
+                           std::chrono::nanoseconds window) {
+  for_each_bit(lines.values, [&](uint32_t line) { m_window[line] = window; });
+}
+
+void Debouncer::set_leading_edge(GpioLineValues lines) noexcept {
+  m_leading |= lines.values;
+}
+
+void Debouncer::reset(GpioLineValues lines, GpioLineValues levels) noexcept {
+  m_stable = (m_stable & ~lines.values) | (levels.values & lines.values);
+  m_raw = (m_raw & ~lines.values) | (levels.values & lines.values);
+  m_pending &= ~lines.values;
+}
+
+void Debouncer::add_edge(uint32_t line, bool level,
+                         std::chrono::nanoseconds timestamp) noexcept {
+  uint64_t bit = uint64_t{1} << line;
+  m_raw = level ? m_raw | bit : m_raw & ~bit;
+  if (!(m_pending & bit)) {
+    m_pending |= bit;
+    m_burst_start[line] = timestamp;
+    if ((m_leading & bit) && level != bool(m_stable & bit)) {
+      m_stable ^= bit;
+      m_changed_at[line] = timestamp;
+      (level ? m_leading_rising : m_leading_falling) |= bit;
+    }
+  }
+  m_last_edge[line] = timestamp;
+  m_deadline[line] = timestamp + m_window[line];
+}
+
+Debouncer::Changes Debouncer::update(std::chrono::nanoseconds now) noexcept {
+  uint64_t settled = 0;
+  for_each_bit(m_pending, [&](uint32_t line) {
+    if (m_deadline[line] <= now) {
+      settled |= uint64_t{1} << line;
+    }
+  });
+
+  // A burst that ends at the level it started from was a glitch and changes
+  // nothing. A leading edge line that ends up back where it was really did
+  // change twice, the second time at its last edge.
+  uint64_t changed = (m_raw ^ m_stable) & settled;
+  m_stable ^= changed;
+  m_pending &= ~settled;
+  for_each_bit(changed, [&](uint32_t line) {
+    m_changed_at[line] = (m_leading >> line & 1) ? m_last_edge[line]
+                                                 : m_burst_start[line];
+  });
+
+  // If nobody saw the leading edge before it was undone there's nothing to
+  // report.
+  uint64_t reverted = (m_leading_rising | m_leading_falling) & changed;
+  m_leading_rising &= ~reverted;
+  m_leading_falling &= ~reverted;
+  changed &= ~reverted;
+
+  Changes ret{GpioLineValues(m_leading_rising | (changed & m_raw)),
+              GpioLineValues(m_leading_falling | (changed & ~m_raw))};
+  m_leading_rising = 0;
+  m_leading_falling = 0;
+  return ret;
+}
+
+std::optional<std::chrono::nanoseconds>
+Debouncer::next_deadline() const noexcept {
+  std::optional<std::chrono::nanoseconds> ret;
+  for_each_bit(m_pending, [&](uint32_t line) {
+    if (!ret || m_deadline[line] < *ret) {
+      ret = m_deadline[line];
+    }
+  });
+  return ret;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "gpio.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+// Per-class debounce windows. Keypads bounce for a long time once their
+// contacts wear; the hook switch has to stay short enough to tell a pulse
+// dial break from a bounce.
+struct DebounceWindows {
+  std::chrono::microseconds keypad{20000};
+  std::chrono::microseconds hook_switch{5000};
+};
+
+// Debounces up to 64 lines of one line request in userspace from the kernel's
+// edge timestamps. Lines are identified by their index in the request, the
+// same bit positions GpioLineValues uses. A line's level is accepted once it
+// has gone a full window without another edge, measured from the timestamp
+// of that edge rather than from when we got around to reading it, so a
+// caller can sleep until next_deadline() and feed in the whole burst at once
+// instead of waking for every bounce. Nothing here allocates.
+class Debouncer {
+public:
+  struct Changes {
+    GpioLineValues rising;
+    GpioLineValues falling;
+
+    bool empty() const noexcept {
+      return rising.values == 0 && falling.values == 0;
+    }
+  };
+
+  void set_window(GpioLineValues lines, std::chrono::nanoseconds window);
+
+  // Makes lines change level on the first edge of a burst and ignore the
+  // rest of it, rather than waiting for the burst to end. For contacts like
+  // the hook switch whose changes matter more than the odd glitch.
+  void set_leading_edge(GpioLineValues lines) noexcept;
+
+  // Takes levels as the settled state of lines and forgets any edges seen on
+  // them so far.
+  void reset(GpioLineValues lines, GpioLineValues levels) noexcept;
+
+  void add_edge(uint32_t line, bool level,
+                std::chrono::nanoseconds timestamp) noexcept;
+
+  // Accepts the level of every line whose window has run out by now, which
+  // must be on the same clock as the edge timestamps.
+  Changes update(std::chrono::nanoseconds now) noexcept;
+
+  GpioLineValues stable() const noexcept { return GpioLineValues(m_stable); }
+  bool pending() const noexcept { return m_pending != 0; }
+  bool pending(GpioLineValues lines) const noexcept {
+    return (m_pending & lines.values) != 0;
+  }
+
+  // When the earliest pending line settles, if any are pending.
+  std::optional<std::chrono::nanoseconds> next_deadline() const noexcept;
+
+  // Timestamp of the first edge of the burst that produced the line's last
+  // accepted change, i.e. when it was really pressed or released.
+  std::chrono::nanoseconds changed_at(uint32_t line) const noexcept {
+    return m_changed_at[line];
+  }
+
+private:
+  uint64_t m_stable = 0;
+  uint64_t m_raw = 0;
+  uint64_t m_pending = 0;
+  uint64_t m_leading = 0;
+  uint64_t m_leading_rising = 0;
+  uint64_t m_leading_falling = 0;
+  std::array<std::chrono::nanoseconds, 64> m_window{};
+  std::array<std::chrono::nanoseconds, 64> m_deadline{};
+  std::array<std::chrono::nanoseconds, 64> m_burst_start{};
+  std::array<std::chrono::nanoseconds, 64> m_last_edge{};
+  std::array<std::chrono::nanoseconds, 64> m_changed_at{};
+};
@@ -1,7 +1,15 @@
 #pragma once
 
+#include "debounce.hpp"
+#include "gpio.hpp"
+#include "pulse_dial.hpp"
+
+#include <array>
 #include <chrono>
+#include <filesystem>
 #include <optional>
+#include <string>
+#include <vector>
 
 class Dialer {
 public:
@@ -12,16 +20,51 @@ public:
     OnHook,
     ButtonDown,
     LoudButton,
+    HookFlash,
     Interrupted,
     WaitTimeout
   };
+  // The clock a dialer's event timestamps are taken from. HTE timestamps
+  // come from the hardware timestamp engine's own counter; they are compared
+  // against CLOCK_MONOTONIC, so latencies derived from them are only
+  // meaningful if the provider is synchronised to it.
+  enum class EventClock { Monotonic, Realtime, HTE };
+
+  // The current time on clock, comparable with event timestamps.
+  static std::chrono::nanoseconds clock_now(EventClock clock) {
+    // steady_clock and system_clock are CLOCK_MONOTONIC and CLOCK_REALTIME.
+    auto now = clock == EventClock::Realtime
+                   ? std::chrono::system_clock::now().time_since_epoch()
+                   : std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now);
+  }
+
   struct EventData {
     explicit EventData(Event event) : event(event) {}
 
     explicit EventData(char ch) : event(Event::ButtonDown), button(ch) {}
 
+    EventData(char ch, std::chrono::nanoseconds timestamp, EventClock clock)
+        : event(Event::ButtonDown), button(ch), timestamp(timestamp),
+          clock(clock) {}
+
+    EventData(Event event, std::chrono::nanoseconds timestamp,
+              EventClock clock)
+        : event(event), timestamp(timestamp), clock(clock) {}
+
     Event event;
     char button = '\0';
+    // When the event physically happened, if the dialer knows.
+    std::optional<std::chrono::nanoseconds> timestamp;
+    EventClock clock = EventClock::Monotonic;
+
+    // How long ago the event happened, or zero if it has no timestamp.
+    std::chrono::nanoseconds age() const {
+      if (!timestamp) {
+        return std::chrono::nanoseconds{0};
+      }
+      return clock_now(clock) - *timestamp;
+    }
   };
 
   virtual void interrupt() = 0;
@@ -44,3 +87,78 @@ public:
 private:
   int m_interrupt_pipe[2];
 };
+
+// A contact wired to a single GPIO input.
+struct GpioInput {
+  std::string line;
+  // The contact pulls the line low when closed.
+  bool active_low = false;
+};
+
+struct GpioDialerOptions {
+  // Closed while the handset is off hook.
+  std::optional<GpioInput> hook_switch;
+  std::optional<GpioInput> loud_button;
+  // Decode a rotary dial on the hook switch.
+  std::optional<PulseDialTiming> pulse_dial;
+  Dialer::EventClock clock = Dialer::EventClock::Monotonic;
+  DebounceWindows debounce;
+};
+
+// Scans a 3x4 keypad matrix and watches the hook switch and loud button,
+// and reports all of them as one stream in the order they happened. Digits
+// can also come from a rotary dial pulsing the hook switch.
+class GpioDialer : public Dialer {
+public:
+  GpioDialer(const std::filesystem::path &gpiochip,
+             const std::array<std::string, 3> &columns,
+             const std::array<std::string, 4> &rows,
+             GpioBackend *backend = GpioBackend::system(),
+             GpioDialerOptions options = {});
+
+  void interrupt() override;
+
+  EventData
+  wait_for_event(std::optional<std::chrono::microseconds> timeout) override;
+
+private:
+  enum class State { Idle, Scanning, WaitForRelease };
+
+  enum class WaitResult { Edges, Interrupted, Timeout };
+
+  constexpr static auto settle_time = std::chrono::milliseconds(10);
+  // Debouncer lines. The rows and columns are the keypad request's lines in
+  // order, the hook switch and loud button come after them.
+  constexpr static uint64_t row_mask = 0xf;
+  constexpr static uint64_t keypad_mask = 0x7f;
+  constexpr static uint32_t hook_line = 7;
+  constexpr static uint32_t loud_line = 8;
+  constexpr static uint64_t control_mask = 0x180;
+
+  WaitResult
+  wait_for_edges(std::optional<std::chrono::steady_clock::time_point> deadline);
+  bool read_pending_edges(GpioChip::LineEventSource &source, bool record);
+  void queue_event(const EventData &event);
+  bool apply_changes(const Debouncer::Changes &changes);
+  void drain_pulse_decoder();
+  bool key_down_before(const EventData &event) const;
+  void resync_rows();
+  char scan_columns();
+
+  State m_state = State::Idle;
+  EventClock m_clock;
+  Debouncer m_debouncer;
+  // Chip offset of each debouncer line, or -1 if it isn't wired up.
+  std::array<uint32_t, 9> m_debounce_lines;
+  bool m_rows_need_resync = false;
+  std::optional<std::chrono::nanoseconds> m_press_timestamp;
+  GpioLineValues m_pressed_rows;
+  std::chrono::steady_clock::time_point m_settled_at;
+  // Hook and loud button events waiting to be returned, oldest first.
+  std::vector<EventData> m_queued_events;
+  std::optional<PulseDialDecoder> m_pulse_decoder;
+  GpioChip m_chip;
+  GpioChip::LineEventSource m_lines;
+  GpioChip::LineEventSource m_controls;
+  std::array<GpioFdHolder, 2> m_interrupt_pipe;
+};
@@ -0,0 +1,119 @@
+#include "dtmf.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr float frequencies[8] = {697, 770, 852, 941, 1209, 1336, 1477, 1633};
+// No A-D, payphones don't have those keys.
+constexpr char keys[4][4] = {{'1', '2', '3', '\0'},
+                             {'4', '5', '6', '\0'},
+                             {'7', '8', '9', '\0'},
+                             {'*', '0', '#', '\0'}};
+
+// The two tones have to carry this much of the block's energy, which is what
+// keeps speech and music from being taken for digits.
+constexpr float min_tone_energy = 0.7f;
+// Every other tone in a group has to be 6dB below the strongest one.
+constexpr float min_group_ratio = 4.0f;
+// Column tone at most 8dB below or 4dB above the row tone.
+constexpr float max_normal_twist = 6.3f;
+constexpr float max_reverse_twist = 2.5f;
+// Mean square of a block, relative to full scale, below which it's silence.
+// About -40dBFS.
+constexpr float min_energy = 1e-4f;
+} // namespace
+
+DtmfDetector::DtmfDetector(unsigned clock_rate)
+    : m_block_size(clock_rate * 205 / 8000) {
+  for (int idx = 0; idx < 8; ++idx) {
+    m_coeffs[idx] = 2 * std::cos(2 * M_PI * frequencies[idx] / clock_rate);
+  }
+  reset();
+}
+
+void DtmfDetector::reset() noexcept {
+  m_s1 = Lanes{};
+  m_s2 = Lanes{};
+  m_energy = 0;
+  m_block_pos = 0;
+  m_last_block = '\0';
+  m_reported = '\0';
+}
+
+char DtmfDetector::process(const int16_t *samples, size_t count) noexcept {
+  char ret = '\0';
+  while (count != 0) {
+    auto todo = std::min(count, m_block_size - m_block_pos);
+    // Every lane runs the same recurrence for its own frequency, so one
+    // sample is a single vector multiply-add for all eight filters.
+    auto s1 = m_s1;
+    auto s2 = m_s2;
+    float energy = m_energy;
+    for (size_t idx = 0; idx < todo; ++idx) {
+      float x = samples[idx] * (1.0f / 32768);
+      auto s = m_coeffs * s1 - s2 + x;
+      s2 = s1;
+      s1 = s;
+      energy += x * x;
+    }
+    m_s1 = s1;
+    m_s2 = s2;
+    m_energy = energy;
+    samples += todo;
+    count -= todo;
+    m_block_pos += todo;
+    if (m_block_pos != m_block_size) {
+      break;
+    }
+
+    auto block = classify();
+    if (block != '\0' && block == m_last_block && block != m_reported) {
+      m_reported = block;
+      ret = block;
+    } else if (block == '\0' && m_last_block == '\0') {
+      m_reported = '\0';
+    }
+    m_last_block = block;
+    m_s1 = Lanes{};
+    m_s2 = Lanes{};
+    m_energy = 0;
+    m_block_pos = 0;
+  }
+  return ret;
+}
+
+char DtmfDetector::classify() const noexcept {
+  if (m_energy < min_energy * m_block_size) {
+    return '\0';
+  }
+
+  Lanes power = m_s1 * m_s1 + m_s2 * m_s2 - m_coeffs * m_s1 * m_s2;
+  int row = 0;
+  int col = 4;
+  for (int idx = 1; idx < 4; ++idx) {
+    if (power[idx] > power[row]) {
+      row = idx;
+    }
+    if (power[idx + 4] > power[col]) {
+      col = idx + 4;
+    }
+  }
+
+  // A pure tone of amplitude a puts (a * n / 2)^2 into its filter and
+  // a^2 * n / 2 into the energy, so the ratio below is 1 for clean DTMF.
+  if (power[row] + power[col] < min_tone_energy * m_energy * m_block_size / 2) {
+    return '\0';
+  }
+  if (power[col] * max_normal_twist < power[row] ||
+      power[col] > power[row] * max_reverse_twist) {
+    return '\0';
+  }
+  for (int idx = 0; idx < 4; ++idx) {
+    if ((idx != row && power[idx] * min_group_ratio > power[row]) ||
+        (idx + 4 != col && power[idx + 4] * min_group_ratio > power[col])) {
+      return '\0';
+    }
+  }
+  return keys[row][col - 4];
+}
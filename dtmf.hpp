@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Detects DTMF digits in 16-bit mono PCM. Runs a bank of eight Goertzel
+// filters, one per DTMF frequency, side by side in SIMD lanes over blocks of
+// 25.6ms (205 samples at 8kHz). A block holds a digit if one row and one
+// column tone carry most of its energy, each clearly beats the other tones in
+// its group, and the twist between them is within what a phone would send.
+// A digit is reported once it has been held for two blocks in a row, and not
+// again until it stops.
+class DtmfDetector {
+public:
+  explicit DtmfDetector(unsigned clock_rate);
+
+  // Feeds any number of samples. Returns the digit that was detected in
+  // them, or '\0'.
+  char process(const int16_t *samples, size_t count) noexcept;
+
+  void reset() noexcept;
+
+private:
+  typedef float Lanes __attribute__((vector_size(32)));
+
+  char classify() const noexcept;
+
+  size_t m_block_size;
+  Lanes m_coeffs;
+  Lanes m_s1;
+  Lanes m_s2;
+  float m_energy = 0;
+  size_t m_block_pos = 0;
+  char m_last_block = '\0';
+  char m_reported = '\0';
+};
@@ -0,0 +1,63 @@
+#include "dtmf_port.hpp"
+
+#include <stdexcept>
+
+InbandDtmfPort::InbandDtmfPort(std::function<void()> on_digit)
+    : m_on_digit(std::move(on_digit)) {
+  pjsua_conf_port_info master_info;
+  if (pjsua_conf_get_port_info(0, &master_info) != PJ_SUCCESS) {
+    throw std::runtime_error("Could not get conference bridge format");
+  }
+  m_detector.emplace(master_info.clock_rate);
+
+  m_pool = pjsua_pool_create("inband-dtmf", 512, 512);
+  pj_str_t name = pj_str(const_cast<char *>("inband-dtmf"));
+  pjmedia_port_info_init(&m_port.info, &name, PJMEDIA_SIG_CLASS_APP('P', 'T'),
+                         master_info.clock_rate, master_info.channel_count,
+                         master_info.bits_per_sample,
+                         master_info.samples_per_frame);
+  m_port.port_data.pdata = this;
+  m_port.put_frame = &InbandDtmfPort::on_put_frame;
+  registerMediaPort2(&m_port, m_pool);
+}
+
+InbandDtmfPort::~InbandDtmfPort() {
+  unregisterMediaPort();
+  pj_pool_release(m_pool);
+}
+
+std::optional<Dialer::EventData> InbandDtmfPort::pop() {
+  auto tail = m_tail.load(std::memory_order_relaxed);
+  if (tail == m_head.load(std::memory_order_acquire)) {
+    return std::nullopt;
+  }
+  auto digit = m_digits[tail % m_digits.size()];
+  m_tail.store(tail + 1, std::memory_order_release);
+  return Dialer::EventData(digit.digit, digit.timestamp,
+                           Dialer::EventClock::Monotonic);
+}
+
+pj_status_t InbandDtmfPort::on_put_frame(pjmedia_port *port,
+                                         pjmedia_frame *frame) {
+  if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO) {
+    return PJ_SUCCESS;
+  }
+  auto self = static_cast<InbandDtmfPort *>(port->port_data.pdata);
+  auto digit =
+      self->m_detector->process(static_cast<const int16_t *>(frame->buf),
+                                frame->size / sizeof(int16_t));
+  if (digit == '\0') {
+    return PJ_SUCCESS;
+  }
+
+  auto head = self->m_head.load(std::memory_order_relaxed);
+  if (head - self->m_tail.load(std::memory_order_acquire) ==
+      self->m_digits.size()) {
+    return PJ_SUCCESS;
+  }
+  self->m_digits[head % self->m_digits.size()] = {
+      digit, Dialer::clock_now(Dialer::EventClock::Monotonic)};
+  self->m_head.store(head + 1, std::memory_order_release);
+  self->m_on_digit();
+  return PJ_SUCCESS;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "dialer.hpp"
+#include "dtmf.hpp"
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <optional>
+
+#include <pjsua2.hpp>
+
+// Listens to a line's capture audio for DTMF sent by the handset itself and
+// hands the digits over to the state machine thread as dialer events. A bare
+// pjmedia_port on the bridge, so the detector reads the bridge's own buffer.
+class InbandDtmfPort : public pj::AudioMedia {
+public:
+  // on_digit is called from the media thread after a digit is queued.
+  explicit InbandDtmfPort(std::function<void()> on_digit);
+  ~InbandDtmfPort();
+
+  InbandDtmfPort(const InbandDtmfPort &) = delete;
+  InbandDtmfPort &operator=(const InbandDtmfPort &) = delete;
+
+  // Takes the oldest detected digit, if there is one. Only call this from a
+  // single thread.
+  std::optional<Dialer::EventData> pop();
+
+private:
+  static pj_status_t on_put_frame(pjmedia_port *port, pjmedia_frame *frame);
+
+  struct Digit {
+    char digit;
+    std::chrono::nanoseconds timestamp;
+  };
+
+  std::function<void()> m_on_digit;
+  std::optional<DtmfDetector> m_detector;
+  // Single producer, single consumer. Digits arriving when it's full are
+  // dropped.
+  std::array<Digit, 16> m_digits;
+  std::atomic<size_t> m_head{0};
+  std::atomic<size_t> m_tail{0};
+  pj_pool_t *m_pool = nullptr;
+  pjmedia_port m_port = {};
+};
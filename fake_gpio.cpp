@@ -0,0 +1,442 @@
+#include "fake_gpio.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+bool is_output(uint64_t flags) { return flags & GPIO_V2_LINE_FLAG_OUTPUT; }
+
+bool is_active_low(uint64_t flags) {
+  return flags & GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+}
+
+uint64_t event_timestamp(uint64_t flags, FakeGpioChip::Clock::time_point when) {
+  auto since = when.time_since_epoch();
+  if (flags & GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME) {
+    since = std::chrono::system_clock::now().time_since_epoch() +
+            (when - FakeGpioChip::Clock::now());
+  }
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(since).count();
+}
+} // namespace
+
+FakeGpioChip::FakeGpioChip(std::string name,
+                           std::vector<std::string> line_names,
+                           std::string label)
+    : m_name(std::move(name)), m_label(std::move(label)) {
+  if (line_names.size() > GPIO_V2_LINES_MAX) {
+    throw std::logic_error("Too many lines for FakeGpioChip");
+  }
+  for (auto &line_name : line_names) {
+    Line line;
+    line.name = std::move(line_name);
+    m_lines.push_back(std::move(line));
+  }
+}
+
+FakeGpioChip::~FakeGpioChip() {
+  for (auto fd : m_chip_fds) {
+    ::close(fd);
+  }
+  for (auto &req : m_requests) {
+    ::close(req.first);
+  }
+}
+
+void FakeGpioChip::set_keypad(const std::vector<std::string> &rows,
+                              const std::vector<std::string> &columns,
+                              const std::vector<std::string> &keys) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_keys.clear();
+  for (size_t row = 0; row < rows.size() && row < keys.size(); ++row) {
+    auto row_line = find_line(rows[row]);
+    for (size_t col = 0; col < columns.size() && col < keys[row].size();
+         ++col) {
+      auto col_line = find_line(columns[col]);
+      if (!row_line || !col_line) {
+        throw std::runtime_error("Keypad line not found in FakeGpioChip");
+      }
+      m_keys[keys[row][col]] = {
+          static_cast<uint32_t>(row_line - m_lines.data()),
+          static_cast<uint32_t>(col_line - m_lines.data())};
+    }
+  }
+}
+
+void FakeGpioChip::set_settle_delay(std::chrono::nanoseconds delay) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_settle_delay = delay;
+}
+
+void FakeGpioChip::press(char key) { set_key(key, true); }
+
+void FakeGpioChip::release(char key) { set_key(key, false); }
+
+void FakeGpioChip::set_key(char key, bool pressed) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  auto it = m_keys.find(key);
+  if (it == m_keys.end()) {
+    throw std::runtime_error("Key not found in FakeGpioChip keypad");
+  }
+  it->second.pressed = pressed;
+  sync_edges(Clock::now());
+}
+
+void FakeGpioChip::set_input(const std::string &name, bool level) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  auto line = find_line(name);
+  if (!line) {
+    throw std::runtime_error("Line not found in FakeGpioChip");
+  }
+  line->input_level = level;
+  sync_edges(Clock::now());
+}
+
+FakeGpioChip::Stats FakeGpioChip::stats() const {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return m_stats;
+}
+
+void FakeGpioChip::reset_stats() {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_stats = {};
+}
+
+int FakeGpioChip::make_fd() {
+  int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd == -1) {
+    int err = errno;
+    throw std::system_error(err, std::system_category());
+  }
+  return fd;
+}
+
+FakeGpioChip::Line *FakeGpioChip::find_line(const std::string &name) {
+  auto it = std::find_if(m_lines.begin(), m_lines.end(),
+                         [&](const Line &line) { return line.name == name; });
+  return it == m_lines.end() ? nullptr : &*it;
+}
+
+bool FakeGpioChip::output_at(const Line &line, Clock::time_point when) const {
+  if (when - line.output_changed < m_settle_delay) {
+    return line.prev_output;
+  }
+  return line.output;
+}
+
+bool FakeGpioChip::level_at(uint32_t offset, Clock::time_point when) const {
+  bool is_row = false;
+  bool driven = false;
+  bool level = false;
+  for (auto &key : m_keys) {
+    if (key.second.row != offset) {
+      continue;
+    }
+    is_row = true;
+    auto &column = m_lines[key.second.column];
+    if (!key.second.pressed || column.request_fd == -1 ||
+        !is_output(column.flags)) {
+      continue;
+    }
+    driven = true;
+    level |= output_at(column, when);
+  }
+
+  if (!is_row) {
+    return m_lines[offset].input_level;
+  }
+  if (driven) {
+    return level;
+  }
+  return m_lines[offset].flags & GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+}
+
+void FakeGpioChip::sync_edges(Clock::time_point when,
+                              std::chrono::nanoseconds settle) {
+  for (uint32_t offset = 0; offset < m_lines.size(); ++offset) {
+    auto &line = m_lines[offset];
+    if (line.request_fd == -1 || is_output(line.flags)) {
+      continue;
+    }
+    bool value = level_at(offset, when + settle) != is_active_low(line.flags);
+    if (value == line.last_level) {
+      continue;
+    }
+    line.last_level = value;
+
+    auto edge_flag =
+        value ? GPIO_V2_LINE_FLAG_EDGE_RISING : GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    if (!(line.flags & edge_flag)) {
+      continue;
+    }
+
+    auto &req = m_requests.at(line.request_fd);
+    gpio_v2_line_event event = {};
+    event.timestamp_ns = event_timestamp(line.flags, when);
+    event.id = value ? GPIO_V2_LINE_EVENT_RISING_EDGE
+                     : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+    event.offset = offset;
+    event.seqno = ++req.seqno;
+    event.line_seqno = ++line.line_seqno;
+    // Like the kernel's kfifo, a full buffer drops the oldest event; the
+    // sequence numbers let readers notice.
+    if (req.events.size() >= req.buffer_size) {
+      req.events.pop_front();
+    }
+    req.events.push_back(event);
+    ++m_stats.events;
+
+    // EAGAIN means the counter is already as high as it goes, which still
+    // leaves the fd readable.
+    uint64_t one = 1;
+    if (::write(line.request_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+      int err = errno;
+      throw std::system_error(err, std::system_category());
+    }
+  }
+}
+
+void FakeGpioChip::apply_config(Request &req,
+                                const gpio_v2_line_config &config) {
+  auto now = Clock::now();
+  for (uint32_t idx = 0; idx < req.offsets.size(); ++idx) {
+    auto &line = m_lines[req.offsets[idx]];
+    uint64_t flags = config.flags;
+    uint32_t debounce_us = 0;
+    std::optional<bool> output;
+    for (uint32_t attr_idx = 0; attr_idx < config.num_attrs; ++attr_idx) {
+      auto &attr = config.attrs[attr_idx];
+      if (!(attr.mask >> idx & 0x1)) {
+        continue;
+      }
+      switch (attr.attr.id) {
+      case GPIO_V2_LINE_ATTR_ID_FLAGS:
+        flags = attr.attr.flags;
+        break;
+      case GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES:
+        output = attr.attr.values >> idx & 0x1;
+        break;
+      case GPIO_V2_LINE_ATTR_ID_DEBOUNCE:
+        debounce_us = attr.attr.debounce_period_us;
+        break;
+      }
+    }
+    line.flags = flags;
+    line.debounce_us = debounce_us;
+    // Logical values, so the level depends on flags that may come after.
+    if (output) {
+      line.output = line.prev_output = *output != is_active_low(flags);
+      line.output_changed = now;
+    }
+  }
+
+  for (auto offset : req.offsets) {
+    auto &line = m_lines[offset];
+    if (!is_output(line.flags)) {
+      line.last_level = level_at(offset, now) != is_active_low(line.flags);
+    }
+  }
+}
+
+int FakeGpioChip::open(const std::filesystem::path &) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  int fd = make_fd();
+  m_chip_fds.push_back(fd);
+  return fd;
+}
+
+int FakeGpioChip::close(int fd) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  if (auto it = std::find(m_chip_fds.begin(), m_chip_fds.end(), fd);
+      it != m_chip_fds.end()) {
+    m_chip_fds.erase(it);
+  } else if (auto req_it = m_requests.find(fd); req_it != m_requests.end()) {
+    for (auto offset : req_it->second.offsets) {
+      auto &line = m_lines[offset];
+      line.request_fd = -1;
+      line.consumer.clear();
+      line.flags = 0;
+      line.debounce_us = 0;
+    }
+    m_requests.erase(req_it);
+  } else {
+    errno = EBADF;
+    return -1;
+  }
+  return ::close(fd);
+}
+
+int FakeGpioChip::ioctl(int fd, unsigned long ctl, void *arg) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  ++m_stats.ioctls;
+  if (std::find(m_chip_fds.begin(), m_chip_fds.end(), fd) !=
+      m_chip_fds.end()) {
+    return handle_chip_ioctl(ctl, arg);
+  }
+  if (auto it = m_requests.find(fd); it != m_requests.end()) {
+    return handle_line_ioctl(fd, it->second, ctl, arg);
+  }
+  errno = EBADF;
+  return -1;
+}
+
+int FakeGpioChip::handle_chip_ioctl(unsigned long ctl, void *arg) {
+  switch (ctl) {
+  case GPIO_GET_CHIPINFO_IOCTL: {
+    auto info = static_cast<gpiochip_info *>(arg);
+    strncpy(info->name, m_name.c_str(), sizeof(info->name) - 1);
+    strncpy(info->label, m_label.c_str(), sizeof(info->label) - 1);
+    info->lines = m_lines.size();
+    return 0;
+  }
+  case GPIO_V2_GET_LINEINFO_IOCTL:
+  case GPIO_V2_GET_LINEINFO_WATCH_IOCTL: {
+    auto info = static_cast<gpio_v2_line_info *>(arg);
+    if (info->offset >= m_lines.size()) {
+      errno = EINVAL;
+      return -1;
+    }
+    auto &line = m_lines[info->offset];
+    strncpy(info->name, line.name.c_str(), sizeof(info->name) - 1);
+    strncpy(info->consumer, line.consumer.c_str(), sizeof(info->consumer) - 1);
+    info->flags = line.flags;
+    if (line.request_fd != -1) {
+      info->flags |= GPIO_V2_LINE_FLAG_USED;
+    }
+    info->num_attrs = 0;
+    if (line.debounce_us) {
+      info->attrs[0].id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+      info->attrs[0].debounce_period_us = line.debounce_us;
+      info->num_attrs = 1;
+    }
+    return 0;
+  }
+  case GPIO_GET_LINEINFO_UNWATCH_IOCTL:
+    return 0;
+  case GPIO_V2_GET_LINE_IOCTL: {
+    auto ioctl_req = static_cast<gpio_v2_line_request *>(arg);
+    if (ioctl_req->num_lines == 0 || ioctl_req->num_lines > GPIO_V2_LINES_MAX) {
+      errno = EINVAL;
+      return -1;
+    }
+    Request req;
+    for (uint32_t idx = 0; idx < ioctl_req->num_lines; ++idx) {
+      auto offset = ioctl_req->offsets[idx];
+      if (offset >= m_lines.size()) {
+        errno = EINVAL;
+        return -1;
+      }
+      if (m_lines[offset].request_fd != -1) {
+        errno = EBUSY;
+        return -1;
+      }
+      req.offsets.push_back(offset);
+    }
+    req.buffer_size = ioctl_req->event_buffer_size
+                          ? ioctl_req->event_buffer_size
+                          : ioctl_req->num_lines * 16;
+
+    int fd = make_fd();
+    for (uint32_t idx = 0; idx < req.offsets.size(); ++idx) {
+      auto &line = m_lines[req.offsets[idx]];
+      line.request_fd = fd;
+      line.request_idx = idx;
+      line.consumer = ioctl_req->consumer;
+    }
+    auto &stored = m_requests.emplace(fd, std::move(req)).first->second;
+    apply_config(stored, ioctl_req->config);
+    ioctl_req->fd = fd;
+    return 0;
+  }
+  }
+  errno = ENOTTY;
+  return -1;
+}
+
+int FakeGpioChip::handle_line_ioctl(int, Request &req, unsigned long ctl,
+                                    void *arg) {
+  switch (ctl) {
+  case GPIO_V2_LINE_SET_CONFIG_IOCTL:
+    ++m_stats.set_config;
+    apply_config(req, *static_cast<gpio_v2_line_config *>(arg));
+    return 0;
+  case GPIO_V2_LINE_GET_VALUES_IOCTL: {
+    ++m_stats.get_values;
+    auto values = static_cast<gpio_v2_line_values *>(arg);
+    auto now = Clock::now();
+    uint64_t bits = 0;
+    for (uint32_t idx = 0; idx < req.offsets.size(); ++idx) {
+      if (!(values->mask >> idx & 0x1)) {
+        continue;
+      }
+      auto &line = m_lines[req.offsets[idx]];
+      bool level = is_output(line.flags) ? line.output
+                                         : level_at(req.offsets[idx], now);
+      if (level != is_active_low(line.flags)) {
+        bits |= uint64_t{1} << idx;
+      }
+    }
+    values->bits = bits;
+    return 0;
+  }
+  case GPIO_V2_LINE_SET_VALUES_IOCTL: {
+    ++m_stats.set_values;
+    auto values = static_cast<gpio_v2_line_values *>(arg);
+    auto now = Clock::now();
+    for (uint32_t idx = 0; idx < req.offsets.size(); ++idx) {
+      auto &line = m_lines[req.offsets[idx]];
+      if (!(values->mask >> idx & 0x1) || !is_output(line.flags)) {
+        continue;
+      }
+      bool level = (values->bits >> idx & 0x1) != is_active_low(line.flags);
+      if (level == line.output) {
+        continue;
+      }
+      line.prev_output = output_at(line, now);
+      line.output = level;
+      line.output_changed = now;
+    }
+    // Stamped now, like the kernel stamps the edge when the write lands,
+    // though GET_VALUES only shows the new level after the settle delay.
+    sync_edges(now, m_settle_delay);
+    return 0;
+  }
+  }
+  errno = ENOTTY;
+  return -1;
+}
+
+ssize_t FakeGpioChip::read(int fd, void *buf, size_t len) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  ++m_stats.reads;
+  auto it = m_requests.find(fd);
+  if (it == m_requests.end()) {
+    errno = EBADF;
+    return -1;
+  }
+  auto &events = it->second.events;
+  if (events.empty()) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  auto out = static_cast<gpio_v2_line_event *>(buf);
+  size_t count = std::min(len / sizeof(gpio_v2_line_event), events.size());
+  if (count == events.size()) {
+    // Nothing left to poll for. EAGAIN means the counter was already clear.
+    uint64_t drained;
+    if (::read(fd, &drained, sizeof(drained)) == -1 && errno != EAGAIN) {
+      return -1;
+    }
+  }
+  std::copy_n(events.begin(), count, out);
+  events.erase(events.begin(), events.begin() + count);
+  return count * sizeof(gpio_v2_line_event);
+}
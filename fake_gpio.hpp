@@ -0,0 +1,109 @@
+#pragma once
+
+#include "gpio.hpp"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// An in-memory gpiochip that answers the GPIO v2 character device ioctls.
+// Lines are identified by name, keep whatever flags/debounce/output values
+// they were configured with, and can be wired into a keypad matrix: a row
+// reads the output value of the column its pressed key connects it to, after
+// the column has had settle_delay to settle. Edge events are generated for
+// lines requested with edge detection and are timestamped in the line's
+// event clock.
+class FakeGpioChip : public GpioBackend {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Stats {
+    uint64_t ioctls = 0;
+    uint64_t get_values = 0;
+    uint64_t set_values = 0;
+    uint64_t set_config = 0;
+    uint64_t reads = 0;
+    uint64_t events = 0;
+  };
+
+  FakeGpioChip(std::string name, std::vector<std::string> line_names,
+               std::string label = "fake-gpiochip");
+  ~FakeGpioChip();
+
+  // keys is row-major, one string per row, one character per column.
+  void set_keypad(const std::vector<std::string> &rows,
+                  const std::vector<std::string> &columns,
+                  const std::vector<std::string> &keys);
+  void set_settle_delay(std::chrono::nanoseconds delay);
+
+  void press(char key);
+  void release(char key);
+
+  // Drives the physical level of a line that isn't part of the keypad.
+  void set_input(const std::string &name, bool level);
+
+  Stats stats() const;
+  void reset_stats();
+
+  int open(const std::filesystem::path &path) override;
+  int close(int fd) override;
+  int ioctl(int fd, unsigned long ctl, void *arg) override;
+  ssize_t read(int fd, void *buf, size_t len) override;
+
+private:
+  struct Line {
+    std::string name;
+    std::string consumer;
+    uint64_t flags = 0;
+    uint32_t debounce_us = 0;
+    int request_fd = -1;
+    uint32_t request_idx = 0;
+    uint32_t line_seqno = 0;
+    bool input_level = false;
+    bool last_level = false;
+    bool output = false;
+    bool prev_output = false;
+    Clock::time_point output_changed;
+  };
+
+  struct Request {
+    std::vector<uint32_t> offsets;
+    std::deque<gpio_v2_line_event> events;
+    size_t buffer_size = 0;
+    uint32_t seqno = 0;
+  };
+
+  struct Key {
+    uint32_t row;
+    uint32_t column;
+    bool pressed = false;
+  };
+
+  int make_fd();
+  Line *find_line(const std::string &name);
+  void apply_config(Request &req, const gpio_v2_line_config &config);
+  bool output_at(const Line &line, Clock::time_point when) const;
+  bool level_at(uint32_t offset, Clock::time_point when) const;
+  // Queues an event for every edge-detecting input whose level differs from
+  // the last one reported, taking levels as they will be once outputs have
+  // had settle to settle, but stamping the events at when.
+  void sync_edges(Clock::time_point when,
+                  std::chrono::nanoseconds settle = {});
+  void set_key(char key, bool pressed);
+
+  int handle_chip_ioctl(unsigned long ctl, void *arg);
+  int handle_line_ioctl(int fd, Request &req, unsigned long ctl, void *arg);
+
+  mutable std::mutex m_mutex;
+  std::string m_name;
+  std::string m_label;
+  std::vector<Line> m_lines;
+  std::map<char, Key> m_keys;
+  std::chrono::nanoseconds m_settle_delay{0};
+  std::vector<int> m_chip_fds;
+  std::map<int, Request> m_requests;
+  Stats m_stats;
+};
@@ -0,0 +1,56 @@
+#include "gain.hpp"
+
+#include <cmath>
+
+namespace {
+// One 128-bit register, SSE or NEON.
+typedef float Floats __attribute__((vector_size(16)));
+typedef int32_t Ints __attribute__((vector_size(16)));
+typedef int16_t Shorts __attribute__((vector_size(8)));
+
+// Above this fraction of full scale the limiter takes over.
+constexpr float knee = 0.5f;
+
+// Identity below the knee. Above it, (1 - knee) * u / (1 + u) of the excess
+// u, which is smooth at the knee and only reaches full scale at infinity.
+inline Floats soft_limit(Floats x) {
+  Floats mag = x < 0 ? -x : x;
+  Floats excess = (mag - knee) * (1 / (1 - knee));
+  Floats limited = knee + (1 - knee) * excess / (1 + excess);
+  Floats out = mag > knee ? limited : mag;
+  return x < 0 ? -out : out;
+}
+} // namespace
+
+LoudGain::LoudGain(float gain_db) : m_gain(std::pow(10.0f, gain_db / 20)) {}
+
+void LoudGain::process(int16_t *samples, size_t count) noexcept {
+  float target = enabled() ? m_gain : 1.0f;
+  if (target == 1.0f && m_current == 1.0f) {
+    return;
+  }
+  float step = count ? (target - m_current) / count : 0;
+  float gain = m_current;
+
+  size_t idx = 0;
+  Floats lane_steps = {0, 1, 2, 3};
+  for (; idx + 4 <= count; idx += 4) {
+    Shorts in;
+    __builtin_memcpy(&in, samples + idx, sizeof(in));
+    auto x = __builtin_convertvector(in, Floats) * (1.0f / 32768);
+    auto y = soft_limit(x * (gain + lane_steps * step));
+    gain += 4 * step;
+    // Rounds to nearest; the limiter keeps y inside (-1, 1).
+    auto out = __builtin_convertvector(
+        __builtin_convertvector(y * 32767 + (y < 0 ? -0.5f : 0.5f), Ints),
+        Shorts);
+    __builtin_memcpy(samples + idx, &out, sizeof(out));
+  }
+  for (; idx < count; ++idx) {
+    Floats x = {samples[idx] * (1.0f / 32768)};
+    auto y = soft_limit(x * gain)[0];
+    gain += step;
+    samples[idx] = static_cast<int16_t>(std::lround(y * 32767));
+  }
+  m_current = target;
+}
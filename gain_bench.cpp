@@ -0,0 +1,76 @@
+#include "gain.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+// The same curve one sample at a time, to check the SIMD path against.
+int16_t reference(int16_t sample, float gain) {
+  constexpr float knee = 0.5f;
+  float x = sample / 32768.0f * gain;
+  float mag = std::fabs(x);
+  if (mag > knee) {
+    float excess = (mag - knee) / (1 - knee);
+    mag = knee + (1 - knee) * excess / (1 + excess);
+  }
+  return static_cast<int16_t>(std::lround(std::copysign(mag, x) * 32767));
+}
+
+void run(size_t frame_size) {
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> dist(-32768, 32767);
+  std::vector<int16_t> pcm(frame_size * 1000);
+  for (auto &sample : pcm) {
+    sample = dist(rng);
+  }
+
+  // Steady state with the gain on, against the reference.
+  LoudGain gain;
+  gain.set_enabled(true);
+  std::vector<int16_t> frame(pcm.begin(), pcm.begin() + frame_size);
+  gain.process(frame.data(), frame.size());
+  int max_error = 0;
+  for (size_t pos = frame_size; pos + frame_size <= pcm.size();
+       pos += frame_size) {
+    frame.assign(pcm.begin() + pos, pcm.begin() + pos + frame_size);
+    gain.process(frame.data(), frame.size());
+    for (size_t idx = 0; idx < frame_size; ++idx) {
+      max_error = std::max(
+          max_error, std::abs(frame[idx] - reference(pcm[pos + idx], 3.981f)));
+    }
+  }
+
+  auto time = [&](bool enabled) {
+    gain.set_enabled(enabled);
+    size_t frames = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < 200; ++pass) {
+      for (size_t pos = 0; pos + frame_size <= pcm.size();
+           pos += frame_size, ++frames) {
+        gain.process(pcm.data() + pos, frame_size);
+      }
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / frames;
+  };
+  auto on_ns = time(true);
+  auto off_ns = time(false);
+
+  std::cout << "frame_size=" << frame_size << " ns_per_frame_on=" << on_ns
+            << " ns_per_frame_off=" << off_ns
+            << " max_error_vs_scalar=" << max_error << std::endl;
+}
+} // namespace
+
+// Measures what the loud button costs per frame on the playback path.
+int main() {
+  for (size_t frame_size : {160, 320, 960}) {
+    run(frame_size);
+  }
+  return 0;
+}
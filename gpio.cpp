@@ -1,6 +1,10 @@
 #include "gpio.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 
 #include <algorithm>
+#include <array>
+#include <cstring>
 
 #include <fcntl.h>
 #include <linux/gpio.h>
@@ -12,14 +16,39 @@ template <class... Ts> struct overloaded : Ts... {
 };
 template <class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
 
+namespace {
+class SystemGpioBackend : public GpioBackend {
+public:
+  int open(const std::filesystem::path &path) override {
+    return ::open(path.c_str(), O_RDWR);
+  }
+
+  int close(int fd) override { return ::close(fd); }
+
+  int ioctl(int fd, unsigned long ctl, void *arg) override {
+    return ::ioctl(fd, ctl, arg);
+  }
+
+  ssize_t read(int fd, void *buf, size_t len) override {
+    return ::read(fd, buf, len);
+  }
+};
+} // namespace
+
+GpioBackend *GpioBackend::system() {
+  static SystemGpioBackend backend;
+  return &backend;
+}
+
 void GpioFdHolder::close() {
   if (fd != -1) {
-    ::close(fd);
+    backend->close(fd);
+    fd = -1;
   }
 }
 
-GpioChip::GpioChip(const std::filesystem::path &path) {
-  m_fd = GpioFdHolder(::open(path.c_str(), O_RDWR));
+GpioChip::GpioChip(const std::filesystem::path &path, GpioBackend *backend) {
+  m_fd = GpioFdHolder(backend->open(path), backend);
   if (m_fd == -1) {
     int err = errno;
     throw std::system_error(err, std::system_category());
@@ -36,10 +65,12 @@ GpioChip::GpioChip(const std::filesystem::path &path) {
   m_all_lines_mask = mask_builder.values;
 }
 
-GpioChip::~GpioChip() { ::close(m_fd); }
+GpioChip::~GpioChip() = default;
 
-template <typename... Args> int GpioChip::LineEventSource::do_ioctl(int ctl, Args... args) {
-  int rc = ::ioctl(fd(), ctl, args...);
+template <typename... Args>
+int GpioChip::LineEventSource::do_ioctl(unsigned long ctl, Args... args) {
+  Trace::Scope trace_scope(Trace::Span::GpioIoctl, ctl);
+  int rc = m_fd.backend->ioctl(fd(), ctl, args...);
   if (rc == -1) {
     int err = errno;
     throw std::system_error(err, std::system_category());
@@ -47,8 +78,10 @@ template <typename... Args> int GpioChip::LineEventSource::do_ioctl(int ctl, Arg
   return rc;
 }
 
-template <typename... Args> int GpioChip::do_ioctl(int ctl, Args... args) {
-  int rc = ::ioctl(m_fd, ctl, args...);
+template <typename... Args>
+int GpioChip::do_ioctl(unsigned long ctl, Args... args) {
+  Trace::Scope trace_scope(Trace::Span::GpioIoctl, ctl);
+  int rc = m_fd.backend->ioctl(m_fd, ctl, args...);
   if (rc == -1) {
     int err = errno;
     throw std::system_error(err, std::system_category());
@@ -142,6 +175,15 @@ GpioChip::LineInfo GpioChip::get_line_info(uint32_t idx, bool add_watch) {
   return ret;
 }
 
+std::optional<uint32_t> GpioChip::find_line(const std::string &name) {
+  for (uint32_t idx = 0; idx < m_lines; ++idx) {
+    if (get_line_info(idx, false).name == name) {
+      return idx;
+    }
+  }
+  return std::nullopt;
+}
+
 GpioChip::LineEventSource
 GpioChip::make_line_event_source(std::vector<uint32_t> line_idxs,
                                  std::string consumer, LineConfig config,
@@ -161,20 +203,28 @@ GpioChip::make_line_event_source(std::vector<uint32_t> line_idxs,
   line_config_to_ioctl(config, &ioctl_req.config);
   ioctl_req.event_buffer_size = event_buffer_size;
   do_ioctl(GPIO_V2_GET_LINE_IOCTL, &ioctl_req);
-  return LineEventSource(GpioFdHolder(ioctl_req.fd),
+  return LineEventSource(GpioFdHolder(ioctl_req.fd, m_fd.backend),
                          ioctl_req.event_buffer_size);
 }
 
 std::vector<GpioLineEventData> GpioChip::LineEventSource::read_events() {
+  std::vector<GpioLineEventData> out(m_buffer_size ? m_buffer_size : 16);
+  out.resize(read_events(out.data(), out.size()));
+  return out;
+}
+
+size_t GpioChip::LineEventSource::read_events(GpioLineEventData *out,
+                                              size_t max_events) {
   if (fd() == -1) {
-    return {};
+    return 0;
   }
 
-  std::vector<gpio_v2_line_event> raw_buf;
-  raw_buf.resize(m_buffer_size ? m_buffer_size : 16);
+  Trace::Scope trace_scope(Trace::Span::GpioRead);
+  std::array<gpio_v2_line_event, 64> raw_buf;
+  max_events = std::min(max_events, raw_buf.size());
 
-  auto read_res =
-      ::read(fd(), raw_buf.data(), raw_buf.size() * sizeof(gpio_v2_line_event));
+  auto read_res = m_fd.backend->read(fd(), raw_buf.data(),
+                                     max_events * sizeof(gpio_v2_line_event));
   if (read_res == -1) {
     int err = errno;
     throw std::system_error(err, std::system_category());
@@ -182,14 +232,19 @@ std::vector<GpioLineEventData> GpioChip::LineEventSource::read_events() {
     throw std::system_error(EIO, std::system_category());
   }
 
-  raw_buf.resize(read_res / sizeof(gpio_v2_line_event));
-
-  std::vector<GpioLineEventData> out;
-  std::transform(raw_buf.begin(), raw_buf.end(), std::back_inserter(out),
-                 [](const gpio_v2_line_event &raw) -> GpioLineEventData {
-                   return {raw.timestamp_ns,
-                           static_cast<GpioLineEventData::EventId>(raw.id),
-                           raw.offset, raw.seqno, raw.line_seqno};
-                 });
-  return out;
+  size_t count = read_res / sizeof(gpio_v2_line_event);
+  for (size_t idx = 0; idx < count; ++idx) {
+    auto &raw = raw_buf[idx];
+    // The kernel drops the oldest events when its buffer fills up, which
+    // shows up as a gap in the request-wide sequence numbers.
+    if (m_last_seqno != 0 && raw.seqno > m_last_seqno + 1) {
+      Metrics::instance().gpio_event_overflows.add(raw.seqno - m_last_seqno -
+                                                   1);
+    }
+    m_last_seqno = raw.seqno;
+    out[idx] = {raw.timestamp_ns,
+                static_cast<GpioLineEventData::EventId>(raw.id), raw.offset,
+                raw.seqno, raw.line_seqno};
+  }
+  return count;
 }
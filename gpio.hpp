@@ -1,7 +1,9 @@
+#pragma once
 
 #include <chrono>
 #include <cstdint>
 #include <filesystem>
+#include <limits>
 #include <optional>
 #include <string>
 #include <utility>
@@ -9,20 +11,39 @@
 #include <vector>
 
 #include <linux/gpio.h>
+#include <sys/types.h>
+
+// The syscalls GpioChip makes against the character device. The default
+// backend forwards straight to the kernel; FakeGpioChip (fake_gpio.hpp)
+// implements them in memory so the GPIO code can run off the board.
+class GpioBackend {
+public:
+  virtual ~GpioBackend() = default;
+
+  virtual int open(const std::filesystem::path &path) = 0;
+  virtual int close(int fd) = 0;
+  virtual int ioctl(int fd, unsigned long ctl, void *arg) = 0;
+  virtual ssize_t read(int fd, void *buf, size_t len) = 0;
+
+  static GpioBackend *system();
+};
 
 struct GpioFdHolder {
   int fd = -1;
+  GpioBackend *backend = GpioBackend::system();
 
   GpioFdHolder() = default;
-  explicit GpioFdHolder(int fd) : fd(fd) {}
+  explicit GpioFdHolder(int fd, GpioBackend *backend = GpioBackend::system())
+      : fd(fd), backend(backend) {}
 
-  GpioFdHolder(GpioFdHolder &&other) : fd(other.fd) {
+  GpioFdHolder(GpioFdHolder &&other) : fd(other.fd), backend(other.backend) {
     other.fd = -1;
   }
 
   GpioFdHolder &operator=(GpioFdHolder &&other) {
     close();
     fd = other.fd;
+    backend = other.backend;
     other.fd = -1;
     return *this;
   }
@@ -69,7 +90,7 @@ struct GpioLineValues {
   bool test(int idx) const noexcept { return (values >> idx & 0x1); }
 
   void set(int idx, bool on = true) noexcept {
-    uint64_t mask = 1 << idx;
+    uint64_t mask = uint64_t{1} << idx;
     if (on) {
       values |= mask;
     } else {
@@ -114,7 +135,8 @@ struct GpioLineAttribute {
 
 class GpioChip {
 public:
-  explicit GpioChip(const std::filesystem::path &path);
+  explicit GpioChip(const std::filesystem::path &path,
+                    GpioBackend *backend = GpioBackend::system());
   ~GpioChip();
 
   struct LineConfig {
@@ -135,6 +157,9 @@ public:
     LineEventSource() = default;
     int fd() const noexcept { return m_fd.fd; }
     std::vector<GpioLineEventData> read_events();
+    // Reads at most max_events (up to 64) into out without allocating and
+    // returns how many were read.
+    size_t read_events(GpioLineEventData *out, size_t max_events);
 
     void update_line_config(LineConfig &&config);
     GpioLineValues get_values(GpioLineValues mask);
@@ -146,10 +171,11 @@ public:
         : m_fd(std::move(fd)), m_buffer_size(buffer_size) {}
 
   private:
-    template <typename... Args> int do_ioctl(int ctl, Args... args);
+    template <typename... Args> int do_ioctl(unsigned long ctl, Args... args);
 
     GpioFdHolder m_fd;
     size_t m_buffer_size;
+    uint32_t m_last_seqno = 0;
   };
 
   const std::string &name() const noexcept { return m_name; }
@@ -158,7 +184,10 @@ public:
 
   size_t size() const noexcept { return m_lines; }
 
+  GpioBackend *backend() const noexcept { return m_fd.backend; }
+
   LineInfo get_line_info(uint32_t idx, bool add_watch);
+  std::optional<uint32_t> find_line(const std::string &name);
   void unwatch_line(uint32_t idx);
 
   LineEventSource make_line_event_source(std::vector<uint32_t> line_idxs,
@@ -171,7 +200,7 @@ protected:
                                    gpio_v2_line_config *out);
 
 private:
-  template <typename... Args> int do_ioctl(int ctl, Args... args);
+  template <typename... Args> int do_ioctl(unsigned long ctl, Args... args);
 
   GpioFdHolder m_fd;
   std::string m_name;
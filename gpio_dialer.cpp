@@ -0,0 +1,449 @@
+#include "dialer.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <system_error>
+#include <thread>
+
+#include <poll.h>
+#include <unistd.h>
+
+template <class... Ts> struct overloaded : Ts... {
+  using Ts::operator()...;
+};
+template <class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+
+GpioDialer::GpioDialer(const std::filesystem::path &gpiochip,
+                       const std::array<std::string, 3> &columns,
+                       const std::array<std::string, 4> &rows,
+                       GpioBackend *backend, GpioDialerOptions options)
+    : m_clock(options.clock), m_chip(gpiochip, backend) {
+  int pipe_fds[2];
+  if (::pipe(pipe_fds) == -1) {
+    int err = errno;
+    throw std::system_error(err, std::system_category());
+  }
+  // Plain pipe fds, closed by the system backend whatever the chip's is.
+  m_interrupt_pipe[0] = GpioFdHolder(pipe_fds[0]);
+  m_interrupt_pipe[1] = GpioFdHolder(pipe_fds[1]);
+
+  std::array<uint32_t, 3> col_idxs;
+  std::array<uint32_t, 4> row_idxs;
+  size_t total_found = 0;
+  size_t total_to_find = col_idxs.size() + row_idxs.size();
+
+  for (uint32_t idx = 0; idx < m_chip.size() && total_found < total_to_find;
+       ++idx) {
+    auto pin = m_chip.get_line_info(idx, false);
+    bool found_match = false;
+    for (size_t i = 0; i < columns.size(); ++i) {
+      if (columns[i] == pin.name) {
+        col_idxs[i] = idx;
+        ++total_found;
+        found_match = true;
+        break;
+      }
+    }
+
+    if (found_match) {
+      continue;
+    }
+
+    for (size_t i = 0; i < rows.size(); ++i) {
+      if (rows[i] == pin.name) {
+        row_idxs[i] = idx;
+        ++total_found;
+        break;
+      }
+    }
+  }
+  if (total_found != total_to_find) {
+    throw std::runtime_error("Could not find all rows/columns in gpiochip");
+  }
+
+  std::vector<uint32_t> selectors = {row_idxs[0], row_idxs[1], row_idxs[2],
+                                     row_idxs[3], col_idxs[0], col_idxs[1],
+                                     col_idxs[2]};
+  m_debounce_lines.fill(-1);
+  std::copy(selectors.begin(), selectors.end(), m_debounce_lines.begin());
+
+  GpioChip::LineConfig line_config;
+  uint64_t clock_flag = 0;
+  if (m_clock == EventClock::Realtime) {
+    clock_flag = GpioLineFlags::EventClockRealtime;
+  } else if (m_clock == EventClock::HTE) {
+    clock_flag = GpioLineFlags::EventClockHTE;
+  }
+  GpioLineFlags row_flags{GpioLineFlags::Input | GpioLineFlags::BiasPullDown |
+                          GpioLineFlags::EdgeRising |
+                          GpioLineFlags::EdgeFalling | clock_flag};
+  GpioLineFlags column_flags{GpioLineFlags::Output | GpioLineFlags::BiasPullUp};
+
+  // Debouncing is done in userspace from the edge timestamps so the kernel
+  // reports every bounce.
+  line_config.attrs = {
+      {{0, 1, 2, 3}, row_flags},
+      {{4, 5, 6}, column_flags},
+      {{4, 5, 6}, GpioLineValues{4, 5, 6}}};
+  m_lines = m_chip.make_line_event_source(selectors, "PhoneDialer",
+                                          std::move(line_config));
+  for (auto &selector : selectors) {
+    auto info = m_chip.get_line_info(selector, false);
+    std::cout << "Line " << selector << " name: " << info.name
+              << " consumer: " << info.consumer
+              << " flags: " << info.flags.flags;
+    for (auto &attr : info.attrs) {
+      std::visit(overloaded{[&](const GpioDebouncePeriod &period) {
+                              std::cout << " debounce period: "
+                                        << period.period.count();
+                            },
+                            [&](const GpioLineValues &values) {
+                              std::cout << " line values: " << values.values;
+                            },
+                            [&](const GpioLineFlags &flags) {
+                              std::cout << " flags: " << flags.flags;
+                            }},
+                 attr.attr);
+    }
+
+    std::cout << std::endl;
+  }
+
+  m_debouncer.set_window({0, 1, 2, 3}, options.debounce.keypad);
+  m_debouncer.reset({0, 1, 2, 3}, m_lines.get_values({0, 1, 2, 3}));
+
+  // Reserved up front so queueing only allocates once more than eight events
+  // are waiting, which takes a caller that stopped asking for them.
+  m_queued_events.reserve(8);
+
+  // The hook switch and loud button get their own request so their edges can
+  // be watched while the keypad rows are still settling.
+  std::vector<uint32_t> control_selectors;
+  GpioChip::LineConfig control_config;
+  auto add_control = [&](const std::optional<GpioInput> &input,
+                         uint32_t debounce_line) {
+    if (!input) {
+      return;
+    }
+    auto offset = m_chip.find_line(input->line);
+    if (!offset) {
+      throw std::runtime_error("Could not find " + input->line +
+                               " in gpiochip");
+    }
+    GpioLineFlags flags{GpioLineFlags::Input | GpioLineFlags::EdgeRising |
+                        GpioLineFlags::EdgeFalling | clock_flag};
+    flags.flags |= input->active_low
+                       ? GpioLineFlags::ActiveLow | GpioLineFlags::BiasPullUp
+                       : GpioLineFlags::BiasPullDown;
+    GpioLineValues request_line;
+    request_line.set(control_selectors.size());
+    control_config.attrs.emplace_back(request_line, flags);
+    control_selectors.push_back(*offset);
+    m_debounce_lines[debounce_line] = *offset;
+  };
+  add_control(options.hook_switch, hook_line);
+  add_control(options.loud_button, loud_line);
+  if (control_selectors.empty()) {
+    return;
+  }
+
+  // Room for all the edges of a dialed zero.
+  m_controls = m_chip.make_line_event_source(
+      control_selectors, "PhoneDialer", std::move(control_config), 64);
+  GpioLineValues request_lines;
+  for (uint32_t idx = 0; idx < control_selectors.size(); ++idx) {
+    request_lines.set(idx);
+  }
+  auto control_values = m_controls.get_values(request_lines);
+  GpioLineValues levels;
+  for (size_t idx = 0, line = hook_line; line <= loud_line; ++line) {
+    if (m_debounce_lines[line] != uint32_t(-1)) {
+      levels.set(line, control_values.test(idx++));
+    }
+  }
+  m_debouncer.set_window({hook_line}, options.debounce.hook_switch);
+  // The loud button is a push button like the keys.
+  m_debouncer.set_window({loud_line}, options.debounce.keypad);
+  m_debouncer.set_leading_edge(GpioLineValues(control_mask));
+  m_debouncer.reset(GpioLineValues(control_mask), levels);
+
+  if (options.hook_switch && levels.test(hook_line)) {
+    m_queued_events.emplace_back(Event::OffHook);
+  }
+  if (options.hook_switch && options.pulse_dial) {
+    m_pulse_decoder.emplace(*options.pulse_dial, levels.test(hook_line));
+  }
+}
+
+void GpioDialer::interrupt() {
+  char ch = 'i';
+  ::write(m_interrupt_pipe[1], &ch, 1);
+}
+
+GpioDialer::WaitResult GpioDialer::wait_for_edges(
+    std::optional<std::chrono::steady_clock::time_point> deadline) {
+  for (;;) {
+    auto wake = deadline;
+    auto wake_at = [&](std::optional<std::chrono::nanoseconds> event_time) {
+      if (!event_time) {
+        return;
+      }
+      auto at = std::chrono::steady_clock::now() +
+                std::chrono::ceil<std::chrono::steady_clock::duration>(
+                    *event_time - clock_now(m_clock));
+      if (!wake || at < *wake) {
+        wake = at;
+      }
+    };
+    wake_at(m_debouncer.next_deadline());
+    if (m_pulse_decoder) {
+      wake_at(m_pulse_decoder->next_deadline());
+    }
+
+    timespec timeout;
+    if (wake) {
+      auto remaining = std::max(std::chrono::steady_clock::duration{0},
+                                *wake - std::chrono::steady_clock::now());
+      auto secs = std::chrono::duration_cast<std::chrono::seconds>(remaining);
+      timeout.tv_sec = secs.count();
+      timeout.tv_nsec =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(remaining - secs)
+              .count();
+    }
+
+    // While a request's lines are settling its fd isn't watched. The rest of
+    // their bounces are read in one go once the window has run out instead of
+    // waking up for each of them.
+    pollfd fds[3] = {{m_interrupt_pipe[0], POLLIN, 0}};
+    nfds_t nfds = 1;
+    if (!m_debouncer.pending(GpioLineValues(keypad_mask))) {
+      fds[nfds++] = {m_lines.fd(), POLLIN, 0};
+    }
+    if (m_controls.fd() != -1 &&
+        !m_debouncer.pending(GpioLineValues(control_mask))) {
+      fds[nfds++] = {m_controls.fd(), POLLIN, 0};
+    }
+    int rc = ::ppoll(fds, nfds, wake ? &timeout : nullptr, nullptr);
+    if (rc == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int err = errno;
+      throw std::system_error(err, std::system_category());
+    }
+    if (rc > 0 && (fds[0].revents & POLLIN)) {
+      char ch;
+      ::read(m_interrupt_pipe[0], &ch, 1);
+      return WaitResult::Interrupted;
+    }
+
+    auto queued = m_queued_events.size();
+    bool changed = read_pending_edges(m_lines, true);
+    changed |= read_pending_edges(m_controls, true);
+    changed |= apply_changes(m_debouncer.update(clock_now(m_clock)));
+    drain_pulse_decoder();
+    if (changed || m_queued_events.size() != queued) {
+      return WaitResult::Edges;
+    }
+    if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+      return WaitResult::Timeout;
+    }
+  }
+}
+
+// Consumes any edges already queued without blocking and hands them to the
+// debouncer. Edges that scanning the columns generated on the rows are thrown
+// away instead. Returns whether any line changed level.
+bool GpioDialer::read_pending_edges(GpioChip::LineEventSource &source,
+                                    bool record) {
+  bool changed = false;
+  if (source.fd() == -1) {
+    return changed;
+  }
+  std::array<GpioLineEventData, 16> events;
+  pollfd fd = {source.fd(), POLLIN, 0};
+  while (::poll(&fd, 1, 0) > 0 && (fd.revents & POLLIN)) {
+    auto count = source.read_events(events.data(), events.size());
+    if (!record) {
+      continue;
+    }
+    for (size_t idx = 0; idx < count; ++idx) {
+      auto &event = events[idx];
+      auto it = std::find(m_debounce_lines.begin(), m_debounce_lines.end(),
+                          event.idx);
+      if (it == m_debounce_lines.end()) {
+        continue;
+      }
+      // Settle whatever had settled by the time of this edge first, so a
+      // backlog of edges decodes the same as if they were read one by one.
+      auto timestamp = std::chrono::nanoseconds{event.timestamp_ns};
+      changed |= apply_changes(m_debouncer.update(timestamp));
+      m_debouncer.add_edge(
+          it - m_debounce_lines.begin(),
+          event.event_id == GpioLineEventData::EventId::RisingEdge,
+          timestamp);
+    }
+  }
+  return changed;
+}
+
+void GpioDialer::queue_event(const EventData &event) {
+  auto it = std::upper_bound(m_queued_events.begin(), m_queued_events.end(),
+                             event, [](const auto &lhs, const auto &rhs) {
+                               return lhs.timestamp < rhs.timestamp;
+                             });
+  m_queued_events.insert(it, event);
+}
+
+bool GpioDialer::apply_changes(const Debouncer::Changes &changes) {
+  if (changes.rising.test(hook_line) || changes.falling.test(hook_line)) {
+    auto off_hook = changes.rising.test(hook_line);
+    auto timestamp = m_debouncer.changed_at(hook_line);
+    if (m_pulse_decoder) {
+      m_pulse_decoder->hook_changed(off_hook, timestamp);
+    } else {
+      queue_event(EventData(off_hook ? Event::OffHook : Event::OnHook,
+                            timestamp, m_clock));
+    }
+  }
+  if (changes.rising.test(loud_line)) {
+    queue_event(EventData(Event::LoudButton,
+                          m_debouncer.changed_at(loud_line), m_clock));
+  }
+  return !changes.empty();
+}
+
+void GpioDialer::drain_pulse_decoder() {
+  if (!m_pulse_decoder) {
+    return;
+  }
+  auto now = clock_now(m_clock);
+  while (auto output = m_pulse_decoder->poll(now)) {
+    switch (output->kind) {
+    case PulseDialDecoder::Kind::Digit:
+      queue_event(EventData(output->digit, output->timestamp, m_clock));
+      break;
+    case PulseDialDecoder::Kind::HookFlash:
+      queue_event(EventData(Event::HookFlash, output->timestamp, m_clock));
+      break;
+    case PulseDialDecoder::Kind::OffHook:
+      queue_event(EventData(Event::OffHook, output->timestamp, m_clock));
+      break;
+    case PulseDialDecoder::Kind::OnHook:
+      queue_event(EventData(Event::OnHook, output->timestamp, m_clock));
+      break;
+    }
+  }
+}
+
+// Whether a key that's down but not scanned yet was pressed before event.
+bool GpioDialer::key_down_before(const EventData &event) const {
+  auto rows = m_debouncer.stable().values & row_mask;
+  return m_state == State::Idle && rows != 0 && event.timestamp &&
+         m_debouncer.changed_at(__builtin_ctzll(rows)) < *event.timestamp;
+}
+
+// Once the columns have settled after a scan, throws away the edges the scan
+// caused and takes the rows as they are now.
+void GpioDialer::resync_rows() {
+  // The rows read low until the restored columns have settled, which would
+  // look like a release.
+  std::this_thread::sleep_until(m_settled_at);
+  read_pending_edges(m_lines, false);
+  m_debouncer.reset({0, 1, 2, 3}, m_lines.get_values({0, 1, 2, 3}));
+  m_rows_need_resync = false;
+}
+
+Dialer::EventData
+GpioDialer::wait_for_event(std::optional<std::chrono::microseconds> timeout) {
+  std::optional<std::chrono::steady_clock::time_point> deadline;
+  if (timeout) {
+    deadline = std::chrono::steady_clock::now() + *timeout;
+  }
+
+  for (;;) {
+    if (!m_queued_events.empty() && !key_down_before(m_queued_events.front())) {
+      auto event = m_queued_events.front();
+      m_queued_events.erase(m_queued_events.begin());
+      return event;
+    }
+
+    switch (m_state) {
+    case State::Idle:
+      if (auto rows = m_debouncer.stable().values & row_mask; rows != 0) {
+        m_press_timestamp = m_debouncer.changed_at(__builtin_ctzll(rows));
+        m_state = State::Scanning;
+        continue;
+      }
+      m_press_timestamp.reset();
+      break;
+    case State::Scanning: {
+      auto scan_start = std::chrono::steady_clock::now();
+      m_pressed_rows = GpioLineValues(m_debouncer.stable().values & row_mask);
+      auto ch = scan_columns();
+      m_rows_need_resync = true;
+      if (ch == '\0') {
+        resync_rows();
+        m_state = State::Idle;
+        continue;
+      }
+      Metrics::instance().keypad_scan.record(
+          std::chrono::steady_clock::now() - scan_start);
+      m_state = State::WaitForRelease;
+      if (m_press_timestamp) {
+        return EventData(ch, *m_press_timestamp, m_clock);
+      }
+      return EventData(ch);
+    }
+    case State::WaitForRelease:
+      if (m_rows_need_resync) {
+        resync_rows();
+      }
+      // Only the rows of the key we reported; a key on another row that
+      // went down in the meantime gets scanned straight away.
+      if ((m_debouncer.stable().values & m_pressed_rows.values) == 0) {
+        m_state = State::Idle;
+        continue;
+      }
+      break;
+    }
+
+    switch (wait_for_edges(deadline)) {
+    case WaitResult::Edges:
+      break;
+    case WaitResult::Interrupted:
+      return EventData(Event::Interrupted);
+    case WaitResult::Timeout:
+      return EventData(Event::WaitTimeout);
+    }
+  }
+}
+
+char GpioDialer::scan_columns() {
+  constexpr static auto selectors =
+      std::initializer_list<std::pair<uint32_t, std::array<char, 4>>>{
+          {4, {'1', '4', '7', '*'}},
+          {5, {'2', '5', '8', '0'}},
+          {6, {'3', '6', '9', '#'}},
+      };
+  char found_ch = '\0';
+  for (auto &col : selectors) {
+    m_lines.set_values({col.first}, {4, 5, 6});
+
+    std::this_thread::sleep_for(settle_time);
+    auto values = m_lines.get_values({0, 1, 2, 3});
+    for (size_t idx = 0; idx < col.second.size() && found_ch == '\0'; ++idx) {
+      if (values.test(idx)) {
+        found_ch = col.second[idx];
+      }
+    }
+    if (found_ch != '\0') {
+      break;
+    }
+  }
+
+  m_lines.set_values({4, 5, 6}, {4, 5, 6});
+  m_settled_at = std::chrono::steady_clock::now() + settle_time;
+  return found_ch;
+}
@@ -1,169 +1,156 @@
 #include "dialer.hpp"
+#include "fake_gpio.hpp"
 #include "gpio.hpp"
 
 #include <array>
 #include <iostream>
+#include <string>
 #include <thread>
 
-#include <poll.h>
-
-template <class... Ts> struct overloaded : Ts... {
-  using Ts::operator()...;
-};
-template <class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
-class GpioDialer : public Dialer {
-public:
-  GpioDialer(const std::filesystem::path &gpiochip,
-             const std::array<std::string, 3> &columns,
-             const std::array<std::string, 4> &rows)
-      : m_chip(gpiochip) {
-    std::array<uint32_t, 3> col_idxs;
-    std::array<uint32_t, 4> row_idxs;
-    size_t total_found = 0;
-    size_t total_to_find = col_idxs.size() + row_idxs.size();
-
-    for (uint32_t idx = 0; idx < m_chip.size() && total_found < total_to_find;
-         ++idx) {
-      auto pin = m_chip.get_line_info(idx, false);
-      bool found_match = false;
-      for (size_t i = 0; i < columns.size(); ++i) {
-        if (columns[i] == pin.name) {
-          col_idxs[i] = idx;
-          ++total_found;
-          found_match = true;
-          break;
-        }
-      }
-
-      if (found_match) {
-        continue;
-      }
-
-      for (size_t i = 0; i < rows.size(); ++i) {
-        if (rows[i] == pin.name) {
-          row_idxs[i] = idx;
-          ++total_found;
-          break;
-        }
-      }
-    }
-    if (total_found != total_to_find) {
-      throw std::runtime_error("Could not find all rows/columns in gpiochip");
-    }
-
-    std::vector<uint32_t> selectors = {row_idxs[0], row_idxs[1], row_idxs[2],
-                                       row_idxs[3], col_idxs[0], col_idxs[1],
-                                       col_idxs[2]};
-
-    GpioChip::LineConfig line_config;
-    GpioLineFlags row_flags{GpioLineFlags::Input | GpioLineFlags::BiasPullDown};
-    GpioLineFlags column_flags{GpioLineFlags::Output | GpioLineFlags::BiasPullUp};
-
-    line_config.attrs = {
-        {{0, 1, 2, 3}, row_flags},
-        {{0, 1, 2, 3}, GpioDebouncePeriod{std::chrono::milliseconds{1}}},
-        {{4, 5, 6}, column_flags},
-        {{4, 5, 6}, GpioLineValues{4, 5, 6}}};
-    m_lines = m_chip.make_line_event_source(selectors, "PhoneDialer",
-                                            std::move(line_config));
-    for (auto &selector : selectors) {
-      auto info = m_chip.get_line_info(selector, false);
-      std::cout << "Line " << selector << " name: " << info.name
-                << " consumer: " << info.consumer
-                << " flags: " << info.flags.flags;
-      for (auto &attr : info.attrs) {
-        std::visit(overloaded{[&](const GpioDebouncePeriod &period) {
-                                std::cout << " debounce period: "
-                                          << period.period.count();
-                              },
-                              [&](const GpioLineValues &values) {
-                                std::cout << " line values: " << values.values;
-                              },
-                              [&](const GpioLineFlags &flags) {
-                                std::cout << " flags: " << flags.flags;
-                              }},
-                   attr.attr);
-      }
-
-      std::cout << std::endl;
-    }
+namespace {
+/*
+BR RD OR YL GR BL PR
+R1 c3 c2 c1 r4 r3 r2
+20 13 21 26 19  6 5
+*/
+const std::array<std::string, 4> rows = {"GPIO20", "GPIO5", "GPIO6", "GPIO19"};
+const std::array<std::string, 3> columns = {"GPIO26", "GPIO21", "GPIO13"};
+
+// Runs the keypad scanner against FakeGpioChip and reports how long each
+// keypress takes to come out of wait_for_event and how many ioctls it cost.
+int run_fake(const std::string &digits) {
+  std::vector<std::string> line_names;
+  for (int idx = 0; idx < 28; ++idx) {
+    line_names.push_back("GPIO" + std::to_string(idx));
   }
-
-  void interrupt() override {}
-  EventData wait_for_event(std::optional<std::chrono::microseconds>) override {
-    for (;;) {
-      switch (m_state) {
-      case State::Idle:
-        if (auto cur_values = m_lines.get_values({0, 1, 2, 3});
-            cur_values.values != 0) {
-          m_state = State::Scanning;
-          continue;
-        }
-
-        break;
-      case State::Scanning:
-        if (auto ch = scan_columns(); ch != '\0') {
-          m_state = State::WaitForRelease;
-          return EventData(ch);
-        }
-        break;
-      case State::WaitForRelease:
-        if (auto cur_values = m_lines.get_values({0, 1, 2, 3});
-            cur_values.values == 0) {
-          m_state = State::Idle;
-          continue;
-        }
-        break;
-      }
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  FakeGpioChip chip("gpiochip0", line_names);
+  chip.set_keypad({rows.begin(), rows.end()}, {columns.begin(), columns.end()},
+                  {"123", "456", "789", "*0#"});
+  chip.set_settle_delay(std::chrono::microseconds{50});
+
+  GpioDialerOptions options;
+  options.hook_switch = GpioInput{"GPIO16", true};
+  chip.set_input("GPIO16", true);
+  GpioDialer dialer("/dev/gpiochip0", columns, rows, &chip, options);
+
+  // Lifting the handset pulls the hook line low.
+  auto hook_start = std::chrono::steady_clock::now();
+  chip.set_input("GPIO16", false);
+  auto hook_event = dialer.wait_for_event(std::nullopt);
+  int failures = hook_event.event != Dialer::Event::OffHook;
+  std::cout << "off hook: got "
+            << (hook_event.event == Dialer::Event::OffHook ? "OffHook"
+                                                            : "other")
+            << " in "
+            << std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - hook_start)
+                   .count()
+            << "us" << std::endl;
+
+  for (auto digit : digits) {
+    chip.reset_stats();
+    auto start = std::chrono::steady_clock::now();
+    // A worn contact bouncing a few times before it closes.
+    for (int bounce = 0; bounce < 3; ++bounce) {
+      chip.press(digit);
+      std::this_thread::sleep_for(std::chrono::microseconds{500});
+      chip.release(digit);
+      std::this_thread::sleep_for(std::chrono::microseconds{500});
     }
-    return EventData(Event::WaitTimeout);
+    chip.press(digit);
+    auto event = dialer.wait_for_event(std::nullopt);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto age = event.age();
+    chip.release(digit);
+    // Let the scanner see the release settle before the next key goes down.
+    dialer.wait_for_event(std::chrono::milliseconds{30});
+    auto stats = chip.stats();
+    failures += event.event != Dialer::Event::ButtonDown ||
+                event.button != digit;
+    std::cout << "pressed " << digit << " got " << event.button << " in "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+                     .count()
+              << "us ("
+              << std::chrono::duration_cast<std::chrono::microseconds>(age)
+                     .count()
+              << "us since the edge) ioctls: " << stats.ioctls
+              << " get_values: " << stats.get_values
+              << " set_values: " << stats.set_values << std::endl;
   }
+  return failures > 0;
+}
 
-private:
-  enum class State { Idle, Scanning, WaitForRelease };
-
-  char scan_columns() {
-    constexpr static auto selectors =
-        std::initializer_list<std::pair<uint32_t, std::array<char, 4>>>{
-            {4, {'1', '4', '7', '*'}},
-            {5, {'2', '5', '8', '0'}},
-            {6, {'3', '6', '9', '#'}},
-        };
-    char found_ch = '\0';
-    for (auto &col : selectors) {
-      m_lines.set_values({col.first}, {4, 5, 6});
-
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-      auto values = m_lines.get_values({0, 1, 2, 3});
-      for (size_t idx = 0; idx < col.second.size() && found_ch == '\0'; ++idx) {
-        if (values.test(idx)) {
-          found_ch = col.second[idx];
-        }
-      }
-      if (found_ch != '\0') {
-        break;
+// Dials digits on a rotary dial wired into the hook loop of FakeGpioChip and
+// reports what comes out and how long after the last pulse.
+int run_fake_pulse(const std::string &digits) {
+  std::vector<std::string> line_names;
+  for (int idx = 0; idx < 28; ++idx) {
+    line_names.push_back("GPIO" + std::to_string(idx));
+  }
+  FakeGpioChip chip("gpiochip0", line_names);
+  chip.set_keypad({rows.begin(), rows.end()}, {columns.begin(), columns.end()},
+                  {"123", "456", "789", "*0#"});
+
+  GpioDialerOptions options;
+  options.hook_switch = GpioInput{"GPIO16", true};
+  options.pulse_dial = PulseDialTiming{};
+  chip.set_input("GPIO16", false);
+  GpioDialer dialer("/dev/gpiochip0", columns, rows, &chip, options);
+  auto event = dialer.wait_for_event(std::nullopt);
+  std::cout << "initial event " << static_cast<int>(event.event) << std::endl;
+  int failures = 0;
+
+  for (auto digit : digits) {
+    // The dial turns on its own while the dialer waits, as it would on the
+    // state machine thread.
+    std::chrono::steady_clock::time_point last_make;
+    std::thread dial([&] {
+      int pulses = digit == '0' ? 10 : digit - '0';
+      for (int pulse = 0; pulse < pulses; ++pulse) {
+        chip.set_input("GPIO16", true);
+        std::this_thread::sleep_for(std::chrono::milliseconds{60});
+        last_make = std::chrono::steady_clock::now();
+        chip.set_input("GPIO16", false);
+        std::this_thread::sleep_for(std::chrono::milliseconds{40});
       }
-    }
-
-    m_lines.set_values({4, 5, 6}, {4, 5, 6});
-    return found_ch;
+    });
+    auto event = dialer.wait_for_event(std::nullopt);
+    dial.join();
+    failures += event.event != Dialer::Event::ButtonDown ||
+                event.button != digit;
+    std::cout << "dialed " << digit << " got " << event.button << " after "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - last_make)
+                     .count()
+              << "ms" << std::endl;
   }
 
-  State m_state = State::Idle;
-  GpioChip m_chip;
-  GpioChip::LineEventSource m_lines;
-};
-
-int main() {
-  /*
-BR RD OR YL GR BL PR
-R1 c3 c2 c1 r4 r3 r2
-20 13 21 26 19  6 5
-  */
+  // A hook flash and then hanging up.
+  chip.set_input("GPIO16", true);
+  std::this_thread::sleep_for(std::chrono::milliseconds{500});
+  chip.set_input("GPIO16", false);
+  event = dialer.wait_for_event(std::nullopt);
+  failures += event.event != Dialer::Event::HookFlash;
+  std::cout << "flash: " << (event.event == Dialer::Event::HookFlash)
+            << std::endl;
+  chip.set_input("GPIO16", true);
+  event = dialer.wait_for_event(std::nullopt);
+  failures += event.event != Dialer::Event::OnHook;
+  std::cout << "on hook: " << (event.event == Dialer::Event::OnHook)
+            << " age " << std::chrono::duration_cast<std::chrono::milliseconds>(
+                            event.age()).count()
+            << "ms" << std::endl;
+  return failures > 0;
+}
+} // namespace
 
-  std::array<std::string, 4> rows = {"GPIO20", "GPIO5", "GPIO6", "GPIO19"};
-  std::array<std::string, 3> columns = {"GPIO26", "GPIO21", "GPIO13"};
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "--fake") {
+    return run_fake(argc > 2 ? argv[2] : "159*0#");
+  }
+  if (argc > 1 && std::string(argv[1]) == "--fake-pulse") {
+    return run_fake_pulse(argc > 2 ? argv[2] : "5550");
+  }
 
   GpioDialer dialer("/dev/gpiochip0", columns, rows);
 
@@ -0,0 +1,515 @@
+#include "line.hpp"
+
+#include "metrics.hpp"
+#include "reg_state.hpp"
+#include "resource_usage.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+Line::Line(std::string name, std::unique_ptr<Dialer> dialer,
+           std::unique_ptr<AudioDevice> audio_device)
+    : m_name(std::move(name)), m_dialer(std::move(dialer)),
+      m_audio_device(std::move(audio_device)) {
+  m_tg.createToneGenerator();
+  m_tg.startTransmit(m_audio_device->playback());
+  m_ringer = std::make_unique<ToneRinger>(m_tg);
+  m_answer_prm.statusCode = PJSIP_SC_OK;
+  m_answer_prm.opt.audioCount = 1;
+  m_answer_prm.opt.videoCount = 0;
+}
+
+Line::~Line() {
+  m_offered_call.reset();
+  m_active_call.reset();
+  m_accounts.clear();
+}
+
+void Line::add_account(const pj::AccountConfig &config, bool make_default,
+                       std::string name) {
+  auto domain = config.idUri.substr(config.idUri.find('@') + 1);
+  std::string transport;
+  auto &registrar = config.regConfig.registrarUri;
+  if (auto param = registrar.find(";transport="); param != std::string::npos) {
+    param += std::strlen(";transport=");
+    transport = registrar.substr(param, registrar.find_first_of(";>", param) -
+                                            param);
+  }
+  m_accounts.push_back(std::make_unique<Account>(
+      this, std::move(name), std::move(domain), std::move(transport)));
+  if (auto saved = RegistrationState::instance().valid(
+          config.idUri, std::chrono::seconds{5})) {
+    std::cout << "*** " << m_name << " " << m_accounts.back()->name()
+              << " resuming registration as " << saved->contact << std::endl;
+    m_accounts.back()->assume_registered_until(saved->expires);
+  }
+  m_accounts.back()->create(config, make_default);
+}
+
+void Line::reregister() {
+  for (auto &account : m_accounts) {
+    try {
+      account->setRegistration(true);
+    } catch (const pj::Error &e) {
+      // Most likely already registering.
+      std::cout << "*** " << m_name << " " << account->name()
+                << " re-register: " << e.info() << std::endl;
+    }
+  }
+}
+
+void Line::registration_changed() {
+  { std::lock_guard<std::mutex> lk(m_reg_mutex); }
+  m_reg_cond.notify_all();
+}
+
+void Line::enable_inband_dtmf() {
+  m_dtmf_port = std::make_unique<InbandDtmfPort>([this] { notify(); });
+  m_audio_device->capture().startTransmit(*m_dtmf_port);
+}
+
+namespace {
+// The user part of "Name" <sip:user@host;params>.
+std::string uri_user(const std::string &uri) {
+  auto user_start = uri.find(':', uri.find('<') + 1);
+  user_start = user_start == std::string::npos ? 0 : user_start + 1;
+  return uri.substr(user_start,
+                    uri.find_first_of("@;>", user_start) - user_start);
+}
+} // namespace
+
+void Line::enable_recording(std::shared_ptr<RecordingWriter> writer,
+                            std::vector<std::string> prefixes) {
+  m_recording_writer = std::move(writer);
+  m_recording_prefixes = std::move(prefixes);
+}
+
+std::unique_ptr<RecorderPort>
+Line::start_recording(const std::string &remote_uri) {
+  if (!m_recording_writer) {
+    return nullptr;
+  }
+  auto user = uri_user(remote_uri);
+  if (!m_recording_prefixes.empty() &&
+      std::none_of(m_recording_prefixes.begin(), m_recording_prefixes.end(),
+                   [&](const std::string &prefix) {
+                     return user.compare(0, prefix.size(), prefix) == 0;
+                   })) {
+    return nullptr;
+  }
+
+  char started[32];
+  auto now = std::time(nullptr);
+  std::strftime(started, sizeof(started), "%Y%m%d-%H%M%S",
+                std::localtime(&now));
+  auto name = m_name + "-" + started + "-" + user;
+  std::replace_if(
+      name.begin(), name.end(),
+      [](char ch) { return !std::isalnum(ch) && ch != '-' && ch != '+'; }, '_');
+  return std::make_unique<RecorderPort>(*m_recording_writer, std::move(name));
+}
+
+void Line::offer_call(std::unique_ptr<Call> call) {
+  std::lock_guard<std::mutex> lk(m_offer_mutex);
+  pj::CallOpParam prm;
+  if (!m_available || m_offered_call) {
+    prm.statusCode = PJSIP_SC_BUSY_HERE;
+    call->hangup(prm);
+    return;
+  }
+
+  prm.statusCode = PJSIP_SC_RINGING;
+  call->answer(prm);
+  m_offered_call = std::move(call);
+  m_available = false;
+  notify();
+}
+
+void Line::set_available() {
+  std::lock_guard<std::mutex> lk(m_offer_mutex);
+  m_available = true;
+}
+
+void Line::begin_cdr(CallRecord::Direction direction, std::string number) {
+  if (!m_cdr_log) {
+    return;
+  }
+  m_cdr_number = std::move(number);
+  m_cdr.emplace();
+  m_cdr->direction = direction;
+  m_cdr->start = std::chrono::system_clock::now();
+}
+
+void Line::answer_cdr() {
+  if (m_cdr) {
+    m_cdr->answer = std::chrono::system_clock::now();
+  }
+}
+
+void Line::end_cdr() {
+  if (!m_cdr) {
+    return;
+  }
+  auto state = m_active_call->get_state();
+  m_cdr->end = std::chrono::system_clock::now();
+  m_cdr->status = state.status_code;
+  m_cdr->hangup_by = state.state == PJSIP_INV_STATE_DISCONNECTED
+                         ? CallRecord::HangupBy::Remote
+                         : CallRecord::HangupBy::Local;
+  m_cdr->number = m_cdr_number;
+  m_cdr_log->append(*m_cdr);
+  m_cdr.reset();
+}
+
+// Prefers registered accounts, then the one the route names, then ones that
+// haven't been failing calls. Skips accounts this call already went through.
+Account *Line::pick_account(bool require_registered) {
+  Account *best = nullptr;
+  int best_rank = -1;
+  for (auto &account : m_accounts) {
+    if (std::find(m_tried_accounts.begin(), m_tried_accounts.end(),
+                  account.get()) != m_tried_accounts.end()) {
+      continue;
+    }
+    bool registered = account->registered();
+    if (require_registered && !registered) {
+      continue;
+    }
+    int rank = (registered ? 4 : 0) +
+               (m_route && m_route->account == account->name() ? 2 : 0) +
+               (account->healthy() ? 1 : 0);
+    if (rank > best_rank) {
+      best = account.get();
+      best_rank = rank;
+    }
+  }
+  return best;
+}
+
+// US ringback, until the far end answers or sends early media.
+void Line::play_ringback() {
+  m_tg.stop();
+  pj::ToneDesc tone_desc;
+  tone_desc.freq1 = 480;
+  tone_desc.freq2 = 440;
+  tone_desc.on_msec = 2000;
+  tone_desc.off_msec = 4000;
+  m_tg.play(pj::ToneDescVector{tone_desc}, true);
+}
+
+void Line::place_call(Account &account) {
+  m_tried_accounts.push_back(&account);
+  std::stringstream ss;
+  ss << "sip:" << m_number_to_dial << "@"
+     << (m_route && !m_route->domain.empty() ? m_route->domain
+                                             : account.domain());
+  auto &transport = m_route && !m_route->transport.empty()
+                        ? m_route->transport
+                        : account.transport();
+  if (!transport.empty()) {
+    ss << ";transport=" << transport;
+  }
+  m_active_call = account.make_call();
+  m_active_call->dial(ss.str());
+}
+
+void Line::run() {
+  {
+    // Any one account is enough for dial tone.
+    std::unique_lock<std::mutex> lk(m_reg_mutex);
+    m_reg_cond.wait(lk, [&] {
+      return std::any_of(m_accounts.begin(), m_accounts.end(),
+                         [](auto &account) { return account->registered(); });
+    });
+  }
+
+  for (;;) {
+    step();
+  }
+}
+
+Dialer::EventData
+Line::wait_for_event(std::optional<std::chrono::microseconds> timeout) {
+  std::optional<std::chrono::steady_clock::time_point> deadline;
+  if (timeout) {
+    deadline = std::chrono::steady_clock::now() + *timeout;
+  }
+  auto event = m_dialer->wait_for_event(timeout);
+  // The in-band detector interrupts the dialer once for every digit it
+  // queues.
+  while (event.event == Dialer::Event::Interrupted && m_dtmf_port) {
+    auto digit = m_dtmf_port->pop();
+    if (!digit) {
+      break;
+    }
+    if (std::chrono::steady_clock::now() - digit->age() >= m_feedback_until) {
+      event = *digit;
+      break;
+    }
+    // The microphone picked up the tone we played for the last digit.
+    if (deadline) {
+      timeout = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::max(*deadline - std::chrono::steady_clock::now(),
+                   std::chrono::steady_clock::duration{0}));
+    }
+    event = m_dialer->wait_for_event(timeout);
+  }
+  // Measure from when the event physically happened if the dialer has a
+  // kernel timestamp for it, not from when we woke up.
+  m_event_time = std::chrono::steady_clock::now() -
+                 std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                     event.age());
+  if (event.event == Dialer::Event::LoudButton) {
+    m_audio_device->set_loud(!m_audio_device->loud());
+  }
+  Trace::instant(Trace::Span::DialerEvent,
+                 static_cast<uint64_t>(event.event) << 8 |
+                     static_cast<uint8_t>(event.button));
+  return event;
+}
+
+void Line::push_digit(char digit) {
+  Trace::Scope trace_scope(Trace::Span::PlayDigit, digit);
+  m_number_to_dial.push_back(digit);
+  m_tg.stop();
+  pj::ToneDigit td;
+  td.digit = digit;
+  td.on_msec = 250;
+  m_tg.playDigits({td});
+  m_feedback_until = std::chrono::steady_clock::now() +
+                     std::chrono::milliseconds{td.on_msec + 50};
+  Metrics::instance().key_to_tone.record(std::chrono::steady_clock::now() -
+                                         m_event_time);
+  m_last_digit_time = m_event_time;
+  while (m_tg.isBusy()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+}
+
+void Line::step() {
+  if (m_state != m_traced_state) {
+    Trace::instant(Trace::Span::StateChange, m_state);
+    m_traced_state = m_state;
+  }
+
+  switch (m_state) {
+  case State::Hangup:
+    end_cdr();
+    m_active_call.reset();
+    m_tg.stop();
+    m_audio_device->set_loud(false);
+    set_available();
+    {
+      auto cpu = thread_cpu_time();
+      Metrics::instance().line_cpu.record(cpu - m_cpu_at_hangup);
+      m_cpu_at_hangup = cpu;
+    }
+    [[fallthrough]];
+  case State::OnHook: {
+    auto event = wait_for_event(std::nullopt);
+    std::unique_ptr<Call> call;
+    {
+      // One look at the offer for both decisions, so a call offered while
+      // the handset comes up is answered rather than left ringing.
+      std::lock_guard<std::mutex> lk(m_offer_mutex);
+      call = std::move(m_offered_call);
+      if (!call && event.event == Dialer::Event::OffHook) {
+        // Going off-hook to dial makes the line busy for incoming calls.
+        m_available = false;
+      }
+    }
+    if (call) {
+      m_active_call = std::move(call);
+      if (m_cdr_log) {
+        begin_cdr(CallRecord::Direction::Incoming,
+                  uri_user(m_active_call->getInfo().remoteUri));
+      }
+      m_ring_on = false;
+      m_ring_toggle = std::chrono::steady_clock::now();
+      m_state = State::Ringing;
+      if (event.event == Dialer::Event::OffHook) {
+        m_active_call->pick_up(m_answer_prm);
+        answer_cdr();
+        m_state = State::InCall;
+      }
+      return;
+    }
+    if (event.event != Dialer::Event::OffHook) {
+      m_state = State::OnHook;
+      return;
+    }
+    m_state = State::DialTone;
+    break;
+  }
+  case State::Ringing: {
+    if (m_active_call->get_state().state == PJSIP_INV_STATE_DISCONNECTED) {
+      m_ringer->set(false);
+      m_state = State::Hangup;
+      return;
+    }
+
+    // US ring cadence, 2s on, 4s off.
+    auto now = std::chrono::steady_clock::now();
+    if (now >= m_ring_toggle) {
+      m_ring_on = !m_ring_on;
+      m_ringer->set(m_ring_on);
+      m_ring_toggle = now + (m_ring_on ? std::chrono::seconds{2}
+                                       : std::chrono::seconds{4});
+    }
+
+    auto event =
+        wait_for_event(std::chrono::duration_cast<std::chrono::microseconds>(
+            m_ring_toggle - now));
+    if (event.event == Dialer::Event::OffHook) {
+      m_ringer->set(false);
+      m_active_call->pick_up(m_answer_prm);
+      answer_cdr();
+      m_state = State::InCall;
+    }
+    break;
+  }
+  case State::DialTone: {
+    pj::ToneDesc tone_desc;
+    tone_desc.freq1 = 350;
+    tone_desc.freq2 = 440;
+    tone_desc.on_msec = std::numeric_limits<short>::max();
+    m_tg.play(pj::ToneDescVector{tone_desc}, true);
+    m_number_to_dial.clear();
+    m_state = State::WaitingForNumber;
+    [[fallthrough]];
+  }
+  case State::WaitingForNumber: {
+    auto event = wait_for_event(std::chrono::seconds{3});
+    if (event.event == Dialer::Event::OnHook) {
+      m_state = State::Hangup;
+      return;
+    }
+
+    if (event.event == Dialer::Event::ButtonDown) {
+      push_digit(event.button);
+    } else if (event.event == Dialer::Event::WaitTimeout &&
+               !m_number_to_dial.empty()) {
+      m_state = State::Dialing;
+      return;
+    }
+
+    break;
+  }
+  case State::Dialing: {
+    play_ringback();
+    begin_cdr(CallRecord::Direction::Outgoing, m_number_to_dial);
+    m_route = nullptr;
+    if (m_routes) {
+      if (m_normalizer) {
+        m_number_to_dial = m_normalizer->normalize(m_number_to_dial);
+      }
+      m_route = m_routes->lookup(m_number_to_dial);
+    }
+    m_tried_accounts.clear();
+    m_early_media = false;
+    auto account = pick_account(false);
+    if (!account) {
+      std::cout << "*** " << m_name << " no account to call "
+                << m_number_to_dial << std::endl;
+      // There's no call for the record to describe.
+      m_cdr.reset();
+      m_state = State::CallError;
+      return;
+    }
+    place_call(*account);
+    {
+      auto press_to_invite = std::chrono::steady_clock::now() - m_last_digit_time;
+      Metrics::instance().digit_to_invite.record(press_to_invite);
+      std::cout << "*** " << m_name << " last press to INVITE: "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(
+                       press_to_invite)
+                       .count()
+                << "ms" << std::endl;
+    }
+    m_state = State::WaitingForAnswer;
+    break;
+  }
+  case State::WaitingForAnswer: {
+    auto event = wait_for_event(std::nullopt);
+    if (event.event == Dialer::Event::OnHook) {
+      m_state = State::Hangup;
+      return;
+    }
+
+    if (event.event == Dialer::Event::ButtonDown) {
+      Metrics::instance().lost_digits.add();
+    }
+    if (event.event != Dialer::Event::Interrupted) {
+      return;
+    }
+    if (m_early_media.exchange(false)) {
+      m_tg.stop();
+    }
+
+    auto ci = m_active_call->get_state();
+    if (ci.state == PJSIP_INV_STATE_CONFIRMED) {
+      answer_cdr();
+      m_state = State::StartCall;
+      break;
+    }
+    if (ci.state == PJSIP_INV_STATE_EARLY) {
+      // Ringing or progress, maybe with early media; keep waiting.
+      return;
+    }
+    if (ci.state == PJSIP_INV_STATE_DISCONNECTED &&
+        (ci.status_code == PJSIP_SC_REQUEST_TIMEOUT ||
+         ci.status_code == PJSIP_SC_SERVICE_UNAVAILABLE)) {
+      auto failed = m_tried_accounts.back();
+      failed->call_failed();
+      if (auto next = pick_account(true)) {
+        std::cout << "*** " << m_name << " " << ci.status_code << " through "
+                  << failed->name() << ", trying " << next->name()
+                  << std::endl;
+        // Early media from the failed attempt may have stopped it.
+        m_early_media = false;
+        play_ringback();
+        place_call(*next);
+        return;
+      }
+    }
+    m_state = State::Hangup;
+    break;
+  }
+  case State::StartCall:
+    m_tg.stop();
+    m_state = State::InCall;
+    [[fallthrough]];
+  case State::InCall: {
+    auto event = wait_for_event(std::nullopt);
+    if (event.event == Dialer::Event::OnHook) {
+      m_state = State::Hangup;
+    }
+    if (event.event == Dialer::Event::ButtonDown) {
+      push_digit(event.button);
+    }
+    break;
+  }
+  case State::CallError: {
+    // Reorder, 480+620Hz at 120 interruptions a minute, until the handset
+    // goes back on hook.
+    pj::ToneDesc tone_desc;
+    tone_desc.freq1 = 480;
+    tone_desc.freq2 = 620;
+    tone_desc.on_msec = 250;
+    tone_desc.off_msec = 250;
+    m_tg.stop();
+    m_tg.play(pj::ToneDescVector{tone_desc}, true);
+    while (wait_for_event(std::nullopt).event != Dialer::Event::OnHook) {
+    }
+    m_state = State::Hangup;
+    break;
+  }
+  }
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "audio_device.hpp"
+#include "cdr.hpp"
+#include "dialer.hpp"
+#include "dtmf_port.hpp"
+#include "recorder_port.hpp"
+#include "ringer.hpp"
+#include "routing.hpp"
+#include "sip.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <pjsua2.hpp>
+
+// One handset: its dialer, SIP account, tone generator, sound device and
+// the call it currently has up. Every line runs its own state machine on its
+// own thread; the pjsip endpoint and conference bridge are shared.
+class Line {
+public:
+  Line(std::string name, std::unique_ptr<Dialer> dialer,
+       std::unique_ptr<AudioDevice> audio_device);
+  ~Line();
+
+  const std::string &name() const noexcept { return m_name; }
+
+  AudioDevice &audio_device() noexcept { return *m_audio_device; }
+
+  // Accounts register in parallel. Calls go through the first healthy one,
+  // in the order they were added, and fail over to the next registered one
+  // on 408 or 503.
+  void add_account(const pj::AccountConfig &config, bool make_default,
+                   std::string name);
+
+  // Called from the pjsip thread when an account's registration changes.
+  void registration_changed();
+
+  // Registers every account again now, reconnecting their transports.
+  void reregister();
+
+  // Also take digits the handset sends as in-band DTMF on its microphone.
+  void enable_inband_dtmf();
+
+  // Record calls to and from numbers starting with one of prefixes, or all
+  // calls if there are none.
+  void enable_recording(std::shared_ptr<RecordingWriter> writer,
+                        std::vector<std::string> prefixes);
+
+  // Called from the pjsip thread once a call's audio is up. Returns nullptr
+  // if the call isn't to be recorded.
+  std::unique_ptr<RecorderPort> start_recording(const std::string &remote_uri);
+
+  // Route dialed numbers through routes, after normalizing them if a
+  // normalizer is given, instead of always calling the registrar.
+  void set_routing(std::shared_ptr<const RouteTable> routes,
+                   std::shared_ptr<const NumberNormalizer> normalizer) {
+    m_routes = std::move(routes);
+    m_normalizer = std::move(normalizer);
+  }
+
+  // Append a record of every call to log.
+  void set_cdr_log(std::shared_ptr<CdrLog> log) { m_cdr_log = std::move(log); }
+
+  // Replaces the default ToneRinger.
+  void set_ringer(std::unique_ptr<Ringer> ringer) {
+    m_ringer = std::move(ringer);
+  }
+
+  // Called from the pjsip thread with a new incoming call. Sends 180 and
+  // hands the call to the state machine if the line is idle, otherwise
+  // rejects it with 486 Busy Here.
+  void offer_call(std::unique_ptr<Call> call);
+
+  // Called from the pjsip thread once an outgoing call's audio is up before
+  // it has been answered. Has the state machine stop the local ringback, so
+  // the caller hears the far end's ringback or announcement instead.
+  void early_media() {
+    m_early_media = true;
+    notify();
+  }
+
+  // Wakes up the state machine from another thread so it re-checks the
+  // active call.
+  void notify() { m_dialer->interrupt(); }
+
+  // Waits for registration and then runs the state machine forever.
+  void run();
+
+  // Runs a single pass of the state machine. May block on the dialer.
+  void step();
+
+private:
+  enum State {
+    OnHook,
+    DialTone,
+    WaitingForNumber,
+    Dialing,
+    WaitingForAnswer,
+    StartCall,
+    InCall,
+    Hangup,
+    CallError,
+    Ringing
+  };
+
+  Dialer::EventData
+  wait_for_event(std::optional<std::chrono::microseconds> timeout);
+  void push_digit(char digit);
+  void set_available();
+  Account *pick_account(bool require_registered);
+  void play_ringback();
+  void place_call(Account &account);
+  void begin_cdr(CallRecord::Direction direction, std::string number);
+  void answer_cdr();
+  void end_cdr();
+
+  std::string m_name;
+  std::unique_ptr<Dialer> m_dialer;
+  std::unique_ptr<AudioDevice> m_audio_device;
+  std::vector<std::unique_ptr<Account>> m_accounts;
+  std::mutex m_reg_mutex;
+  std::condition_variable m_reg_cond;
+  // Accounts the current outgoing call has been placed through, in order.
+  std::vector<Account *> m_tried_accounts;
+  const Route *m_route = nullptr;
+  std::unique_ptr<Call> m_active_call;
+  pj::ToneGenerator m_tg;
+  std::unique_ptr<Ringer> m_ringer;
+  std::unique_ptr<InbandDtmfPort> m_dtmf_port;
+  std::shared_ptr<RecordingWriter> m_recording_writer;
+  std::vector<std::string> m_recording_prefixes;
+  std::shared_ptr<CdrLog> m_cdr_log;
+  std::shared_ptr<const RouteTable> m_routes;
+  std::shared_ptr<const NumberNormalizer> m_normalizer;
+  // The call in progress, appended to m_cdr_log when it ends.
+  std::optional<CallRecord> m_cdr;
+  std::string m_cdr_number;
+  // Built once so answering doesn't allocate on the off-hook path.
+  pj::CallOpParam m_answer_prm;
+
+  std::mutex m_offer_mutex;
+  bool m_available = true;
+  std::unique_ptr<Call> m_offered_call;
+  bool m_ring_on = false;
+  std::chrono::steady_clock::time_point m_ring_toggle;
+
+  State m_state = State::OnHook;
+  State m_traced_state = State::OnHook;
+  std::chrono::nanoseconds m_cpu_at_hangup{0};
+  std::string m_number_to_dial;
+  // Set by early_media(); the tone generator is only touched by this thread.
+  std::atomic<bool> m_early_media{false};
+  std::chrono::steady_clock::time_point m_event_time;
+  std::chrono::steady_clock::time_point m_last_digit_time;
+  // Until when the handset may still be hearing our own DTMF feedback.
+  std::chrono::steady_clock::time_point m_feedback_until;
+};
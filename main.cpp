@@ -1,13 +1,21 @@
-#include <condition_variable>
-#include <mutex>
+#include <cmath>
+#include <csignal>
 #include <fstream>
 #include <iostream>
 #include <optional>
-#include <sstream>
-#include <stack>
 #include <thread>
+#include <utility>
 
+#include "audio_device.hpp"
 #include "dialer.hpp"
+#include "line.hpp"
+#include "metrics.hpp"
+#include "realtime.hpp"
+#include "reg_state.hpp"
+#include "resource_usage.hpp"
+#include "ringer.hpp"
+#include "sip.hpp"
+#include "trace.hpp"
 #include "yaml_persisted_obj.hpp"
 
 #include <phonenumbers/phonenumberutil.h>
@@ -17,319 +25,394 @@
 
 using namespace i18n;
 
-class Endpoint : public pj::Endpoint {
-public:
-  virtual pj_status_t onCredAuth(pj::OnCredAuthParam &prm) {
-    PJ_UNUSED_ARG(prm);
-    std::cout << "*** Callback onCredAuth called ***" << std::endl;
-    /* Return PJ_ENOTSUP to use
-     * pjsip_auth_create_aka_response()/<b>libmilenage</b> (default),
-     * if PJSIP_HAS_DIGEST_AKA_AUTH is defined.
-     */
-    return PJ_ENOTSUP;
-  }
-};
-
-class Call : public pj::Call {
-public:
-  Call(pj::Account &account, Dialer *dialer, int call_id = PJSUA_INVALID_ID)
-      : pj::Call(account, call_id), m_dialer(dialer) {}
-
-  struct State {
-    pjsip_inv_state state;
-    pjsip_status_code status_code;
+Dialer::EventClock parse_event_clock(const YAML::Node &node) {
+  auto name = node.as<std::string>("monotonic");
+  if (name == "realtime") {
+    return Dialer::EventClock::Realtime;
+  } else if (name == "hte") {
+    return Dialer::EventClock::HTE;
+  } else if (name != "monotonic") {
+    throw std::runtime_error("Unknown eventClock " + name);
+  }
+  return Dialer::EventClock::Monotonic;
+}
+
+template <size_t N>
+std::array<std::string, N> read_line_names(const YAML::Node &node) {
+  auto names = node.as<std::vector<std::string>>();
+  if (names.size() != N) {
+    throw std::runtime_error("Expected " + std::to_string(N) + " line names");
+  }
+  std::array<std::string, N> ret;
+  std::copy(names.begin(), names.end(), ret.begin());
+  return ret;
+}
+
+// Windows are in microseconds.
+DebounceWindows read_debounce_windows(const YAML::Node &node) {
+  DebounceWindows windows;
+  if (!node.IsMap()) {
+    return windows;
+  }
+  windows.keypad = std::chrono::microseconds{
+      node["keypad"].as<int64_t>(windows.keypad.count())};
+  windows.hook_switch = std::chrono::microseconds{
+      node["hookSwitch"].as<int64_t>(windows.hook_switch.count())};
+  return windows;
+}
+
+std::optional<GpioInput> read_gpio_input(const YAML::Node &node) {
+  if (!node.IsDefined()) {
+    return std::nullopt;
+  }
+  if (node.IsScalar()) {
+    return GpioInput{node.as<std::string>()};
+  }
+  return GpioInput{node["line"].as<std::string>(),
+                   node["activeLow"].as<bool>(false)};
+}
+
+// Timings are in microseconds. true takes the defaults.
+std::optional<PulseDialTiming> read_pulse_dial_timing(const YAML::Node &node) {
+  if (!node.IsDefined() || (node.IsScalar() && !node.as<bool>())) {
+    return std::nullopt;
+  }
+  PulseDialTiming timing;
+  if (!node.IsMap()) {
+    return timing;
+  }
+  auto read = [&](const char *key, std::chrono::microseconds &value) {
+    value = std::chrono::microseconds{node[key].as<int64_t>(value.count())};
   };
+  read("minBreak", timing.min_break);
+  read("maxBreak", timing.max_break);
+  read("onHook", timing.on_hook);
+  read("minInterDigit", timing.min_inter_digit);
+  return timing;
+}
 
-  State get_state() {
-    std::lock_guard<std::mutex> lk(m_mutex);
-    return {m_last_state, m_last_status_code};
+std::unique_ptr<Dialer> make_dialer(const YAML::Node &dialer_node) {
+  auto type = dialer_node["type"].as<std::string>("cin");
+  if (type == "cin") {
+    return std::make_unique<CinDialer>();
+  } else if (type == "gpio") {
+    GpioDialerOptions options;
+    options.hook_switch = read_gpio_input(dialer_node["hookSwitch"]);
+    options.loud_button = read_gpio_input(dialer_node["loudButton"]);
+    options.pulse_dial = read_pulse_dial_timing(dialer_node["pulseDial"]);
+    options.clock = parse_event_clock(dialer_node["eventClock"]);
+    options.debounce = read_debounce_windows(dialer_node["debounce"]);
+    return std::make_unique<GpioDialer>(
+        dialer_node["chip"].as<std::string>("/dev/gpiochip0"),
+        read_line_names<3>(dialer_node["columns"]),
+        read_line_names<4>(dialer_node["rows"]), GpioBackend::system(),
+        std::move(options));
   }
+  throw std::runtime_error("Unknown dialer type " + type);
+}
 
-protected:
-  // Notification when call's state has changed.
-  void onCallState(pj::OnCallStateParam &prm) override {
-    auto ci = getInfo();
-    if (ci.state != PJSIP_INV_STATE_DISCONNECTED &&
-        ci.state != PJSIP_INV_STATE_EARLY &&
-        ci.state != PJSIP_INV_STATE_CONFIRMED) {
-      return;
+ThreadClass read_thread_class(const YAML::Node &node) {
+  ThreadClass thread_class;
+  if (node.IsMap()) {
+    thread_class.priority = node["priority"].as<int>(0);
+    if (auto cpus_node = node["cpus"]) {
+      thread_class.cpus = cpus_node.as<std::vector<int>>();
     }
-    std::lock_guard<std::mutex> lk(m_mutex);
-    m_last_state = ci.state;
-    m_last_status_code = ci.lastStatusCode;
-    m_dialer->interrupt();
   }
+  return thread_class;
+}
 
-  // Notification when call's media state has changed.
-  void onCallMediaState(pj::OnCallMediaStateParam &) override {
-    pj::CallInfo ci = getInfo();
-
-    for (unsigned i = 0; i < ci.media.size(); i++) {
-      if (ci.media[i].type == PJMEDIA_TYPE_AUDIO && getMedia(i)) {
-        pj::AudioMedia *aud_med = (pj::AudioMedia *)getMedia(i);
+pjsip_transport_type_e parse_transport_type(const YAML::Node &node) {
+  auto name = node.as<std::string>("udp");
+  if (name == "tcp") {
+    return PJSIP_TRANSPORT_TCP;
+  } else if (name == "tls") {
+    return PJSIP_TRANSPORT_TLS;
+  } else if (name != "udp") {
+    throw std::runtime_error("Unknown transport type " + name);
+  }
+  return PJSIP_TRANSPORT_UDP;
+}
 
-        // Connect the call audio media to sound device
-        pj::AudDevManager &mgr = Endpoint::instance().audDevManager();
-        aud_med->startTransmit(mgr.getPlaybackDevMedia());
-        mgr.getCaptureDevMedia().startTransmit(*aud_med);
-      }
+// Sends everything for the account over one connection oriented transport.
+// Registering opens the connection, so calls go out on a warm one.
+void use_transport(pj::AccountConfig &ac, int transport_id,
+                   const std::string &name) {
+  ac.sipConfig.transportId = transport_id;
+  auto add_param = [&](std::string &uri) {
+    if (!uri.empty() && uri.find(";transport=") == std::string::npos) {
+      uri += ";transport=" + name;
     }
+  };
+  add_param(ac.regConfig.registrarUri);
+  for (auto &proxy : ac.sipConfig.proxies) {
+    add_param(proxy);
   }
+}
 
-private:
-  std::mutex m_mutex;
-  pjsip_inv_state m_last_state = PJSIP_INV_STATE_NULL;
-  pjsip_status_code m_last_status_code = PJSIP_SC_NULL;
-  Dialer *m_dialer;
-};
-
-class Account : public pj::Account {
-public:
-  explicit Account(Dialer *dialer) : m_dialer(dialer) {}
-
-  void wait_for_register() {
-    std::unique_lock<std::mutex> lk(m_mutex);
-    m_cond.wait(lk, [&] { return m_registered; });
-  }
-
-  std::unique_ptr<Call> make_call() {
-    return std::make_unique<Call>(*this, m_dialer);
-  }
-
-protected:
-  virtual void onRegState(pj::OnRegStateParam &prm) {
-    pj::AccountInfo ai = getInfo();
-    std::cout << (ai.regIsActive ? "*** Register: code="
-                                 : "*** Unregister: code=")
-              << prm.code << std::endl;
-    std::lock_guard<std::mutex> lk(m_mutex);
-    m_registered = ai.regIsActive;
-    m_cond.notify_one();
-  }
-
-  virtual void onIncomingCall(pj::OnIncomingCallParam &iprm) {
-    auto call = std::make_unique<Call>(*this, m_dialer, iprm.callId);
-
-    // Just hangup for now
-    pj::CallOpParam op;
-    op.statusCode = PJSIP_SC_DECLINE;
-    call->hangup(op);
-  }
-
-private:
-  Dialer *m_dialer;
-  std::mutex m_mutex;
-  std::condition_variable m_cond;
-  bool m_registered = false;
-};
-
-enum State {
-  OnHook,
-  DialTone,
-  WaitingForNumber,
-  Dialing,
-  WaitingForAnswer,
-  StartCall,
-  InCall,
-  Hangup,
-  CallError
-};
-
-template <typename T> YAML::Node get_defaults() {
-  YamlReader foo({}, "Defaults", {});
-  T obj{};
-  obj.writeObject(foo.get_pj_container_node());
-  return foo.nodes[0].second.first.begin()->second;
+// Disables the codecs in disable, then sets the given priorities. Codec ids
+// match by prefix, so "speex" covers every clock rate and "*" every codec.
+void configure_codecs(pj::Endpoint &ep, const YAML::Node &codecs_node) {
+  if (!codecs_node.IsMap()) {
+    return;
+  }
+  auto codec_id = [](std::string id) { return id == "*" ? "" : id; };
+  for (auto &&id : codecs_node["disable"]) {
+    ep.codecSetPriority(codec_id(id.as<std::string>()), 0);
+  }
+  for (auto &&priority : codecs_node["priorities"]) {
+    ep.codecSetPriority(codec_id(priority.first.as<std::string>()),
+                        priority.second.as<unsigned>());
+  }
+  for (auto &codec : ep.codecEnum2()) {
+    if (codec.priority > 0) {
+      std::cout << "*** Codec " << codec.codecId << " priority "
+                << static_cast<unsigned>(codec.priority) << std::endl;
+    }
+  }
 }
 
-template <typename T>
-T read_config_object(YAML::Node config_node, std::string name) {
-  T obj;
-  if (config_node.IsDefined()) {
-    auto default_node = get_defaults<T>();
-    YamlReader reader(std::move(config_node), std::move(name),
-                      std::move(default_node));
-    obj.readObject(reader.get_pj_container_node());
+// Picks the capture and playback devices for the first entry of dev_order
+// that matches any device name.
+std::pair<int, int> find_audio_devices(const YAML::Node &dev_order) {
+  std::pair<int, int> devs = {PJMEDIA_AUD_DEFAULT_CAPTURE_DEV,
+                              PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV};
+  if (!dev_order.IsSequence()) {
+    return devs;
+  }
+
+  auto &aud_dev_mgr = pj::Endpoint::instance().audDevManager();
+  auto lookup_aud_dev = [&](const pj::AudioDevInfo &dev_info) {
+    pjmedia_aud_dev_index dev_index = 0;
+    pjmedia_aud_dev_lookup(dev_info.driver.c_str(), dev_info.name.c_str(),
+                           &dev_index);
+    return dev_index;
+  };
+
+  for (auto &&needle : dev_order) {
+    bool found = false;
+    for (auto &aud_dev : aud_dev_mgr.enumDev2()) {
+      if (aud_dev.name.find(needle.as<std::string>()) == std::string::npos) {
+        continue;
+      }
+      found = true;
+      if (aud_dev.inputCount > 0) {
+        devs.first = lookup_aud_dev(aud_dev);
+      }
+      if (aud_dev.outputCount) {
+        devs.second = lookup_aud_dev(aud_dev);
+      }
+    }
+    if (found) {
+      break;
+    }
   }
-  return obj;
+  return devs;
 }
 
 int main(int argc, char **argv) {
 
   auto config_node = YAML::LoadFile(argv[1]);
-  pj::EpConfig ep_config;
+  if (auto trace_node = config_node["trace"]; trace_node.IsMap()) {
+    Trace::enable(trace_node["bufferSize"].as<size_t>(65536));
+    Trace::install_dump_signal(
+        SIGUSR1,
+        trace_node["dumpPath"].as<std::string>("payphone-trace.json"));
+  }
+  if (auto metrics_node = config_node["metrics"]; metrics_node.IsMap()) {
+    Metrics::instance().serve(metrics_node["socketPath"].as<std::string>());
+  }
+
+  auto ep_config =
+      read_config_object<pj::EpConfig>(config_node["epConfig"], "EpConfig");
   Endpoint ep;
   ep.libCreate();
   ep.libInit(ep_config);
-
-  auto tc = read_config_object<pj::TransportConfig>(
-      config_node["transportConfig"], "TransportConfig");
+  if (auto pool_node = config_node["poolCacheKB"]) {
+    set_pool_cache_kb(pool_node.as<size_t>());
+  }
+  configure_codecs(ep, config_node["codecs"]);
+
+  auto transport_node = config_node["transportConfig"];
+  auto transport_type = parse_transport_type(transport_node["type"]);
+  auto transport_name = transport_node["type"].as<std::string>("udp");
+  auto keep_alive = transport_node["keepAliveSec"].as<int>(15);
+  auto tc = read_config_object<pj::TransportConfig>(transport_node,
+                                                    "TransportConfig");
   if (tc.port == 0) {
-    tc.port = 5060;
+    tc.port = transport_type == PJSIP_TRANSPORT_TLS ? 5061 : 5060;
+  }
+  if (transport_type != PJSIP_TRANSPORT_UDP) {
+    // CRLF keepalives hold NAT bindings open and notice a dead connection
+    // long before the next REGISTER would.
+    pjsip_cfg()->tcp.keep_alive_interval = keep_alive;
+    pjsip_cfg()->tls.keep_alive_interval = keep_alive;
   }
-  ep.transportCreate(PJSIP_TRANSPORT_UDP, tc);
+  auto transport_id = ep.transportCreate(transport_type, tc);
 
   ep.libStart();
 
-  CinDialer dialer;
+  if (auto state_node = config_node["stateFile"]) {
+    RegistrationState::instance().load(state_node.as<std::string>());
+  }
 
-  auto ac = read_config_object<pj::AccountConfig>(config_node["accountConfig"],
-                                                  "AccountConfig");
-  auto account = std::make_unique<Account>(&dialer);
-  account->create(ac, true);
+  // Before any line exists: the sound device threads read this on every
+  // frame from the moment their streams start.
+  if (auto realtime_node = config_node["realtime"]; realtime_node.IsMap()) {
+    auto &realtime = Realtime::instance();
+    realtime.configure(read_thread_class(realtime_node["control"]),
+                       read_thread_class(realtime_node["media"]),
+                       realtime_node["lockMemory"].as<bool>(true),
+                       realtime_node["prefaultKB"].as<size_t>(4096));
+    // pjmedia's RTP workers; the sound device threads, which the lines
+    // start, set themselves up on their first frame.
+    std::cout << "*** Realtime mode, " << realtime.adopt_threads("media")
+              << " media worker threads" << std::endl;
+  }
 
-  account->wait_for_register();
+  // A config without a lines section describes a single handset at the top
+  // level.
+  std::vector<YAML::Node> line_nodes;
+  if (auto lines_node = config_node["lines"]; lines_node.IsSequence()) {
+    for (auto &&line_node : lines_node) {
+      line_nodes.push_back(line_node);
+    }
+  } else {
+    line_nodes.push_back(config_node);
+  }
 
-  pj::ToneGenerator tg;
-  tg.createToneGenerator();
-  auto &aud_dev_mgr = ep.audDevManager();
-  auto lookup_aud_dev = [&](const pj::AudioDevInfo &dev_info) {
-    pjmedia_aud_dev_index dev_index = 0;
-    pjmedia_aud_dev_lookup(dev_info.driver.c_str(), dev_info.name.c_str(),
-                           &dev_index);
-    return dev_index;
-  };
+  std::shared_ptr<RecordingWriter> recording_writer;
+  std::vector<std::string> recording_prefixes;
+  if (auto recording_node = config_node["recording"];
+      recording_node.IsMap()) {
+    recording_writer = std::make_shared<RecordingWriter>(
+        recording_node["directory"].as<std::string>(),
+        std::chrono::seconds{recording_node["segmentSeconds"].as<int>(300)});
+    if (auto prefixes_node = recording_node["prefixes"]) {
+      recording_prefixes = prefixes_node.as<std::vector<std::string>>();
+    }
+    std::cout << "*** Recording calls with " << recording_writer->backend()
+              << std::endl;
+  }
 
-  if (auto dev_order = config_node["audioDevOrder"]; dev_order.IsSequence()) {
-    for (auto &&needle : dev_order) {
-      bool found = false;
-      for (auto &aud_dev : aud_dev_mgr.enumDev2()) {
-        if (aud_dev.name.find(needle.as<std::string>()) == std::string::npos) {
-          continue;
-        }
-        found = true;
-        if (aud_dev.inputCount > 0) {
-          aud_dev_mgr.setCaptureDev(lookup_aud_dev(aud_dev));
-        }
-        if (aud_dev.outputCount) {
-          aud_dev_mgr.setPlaybackDev(lookup_aud_dev(aud_dev));
-        }
-      }
-      if (found) {
-        break;
-      }
+  std::shared_ptr<const RouteTable> routes;
+  std::shared_ptr<const NumberNormalizer> normalizer;
+  if (auto routing_node = config_node["routing"]; routing_node.IsMap()) {
+    std::vector<RouteEntry> entries;
+    if (auto csv_node = routing_node["csv"]) {
+      entries = read_route_csv(csv_node.as<std::string>());
+    }
+    for (auto &&route_node : routing_node["routes"]) {
+      entries.push_back({route_node["prefix"].as<std::string>(),
+                         {route_node["account"].as<std::string>(""),
+                          route_node["domain"].as<std::string>(""),
+                          route_node["transport"].as<std::string>("")}});
+    }
+    routes = std::make_shared<RouteTable>(std::move(entries));
+    if (auto region_node = routing_node["region"]) {
+      normalizer =
+          std::make_shared<NumberNormalizer>(region_node.as<std::string>());
     }
+    std::cout << "*** " << routes->size() << " routes, "
+              << routes->memory_usage() / 1024 << "kB" << std::endl;
   }
-  auto &playback = aud_dev_mgr.getPlaybackDevMedia();
 
-  State state = State::OnHook;
+  std::shared_ptr<CdrLog> cdr_log;
+  if (auto cdr_node = config_node["cdr"]; cdr_node.IsMap()) {
+    cdr_log = std::make_shared<CdrLog>(
+        cdr_node["path"].as<std::string>(),
+        cdr_node["capacity"].as<size_t>(1000000));
+  }
 
-  std::string number_to_dial;
-  auto push_digit = [&](char digit) {
-    number_to_dial.push_back(digit);
-    tg.stop();
-    pj::ToneDigit td;
-    td.digit = digit;
-    td.on_msec = 250;
-    tg.playDigits({td});
-    while (tg.isBusy()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  std::vector<std::unique_ptr<Line>> lines;
+  for (size_t idx = 0; idx < line_nodes.size(); ++idx) {
+    auto &line_node = line_nodes[idx];
+    auto rss_before = current_rss_kb();
+    auto name =
+        line_node["name"].as<std::string>("line" + std::to_string(idx));
+    auto devs = find_audio_devices(line_node["audioDevOrder"]);
+    auto line = std::make_unique<Line>(
+        name, make_dialer(line_node["dialer"]),
+        std::make_unique<AudioDevice>(devs.first, devs.second, idx == 0));
+
+    if (auto ringer_node = line_node["ringer"]; ringer_node.IsMap()) {
+      line->set_ringer(std::make_unique<GpioRinger>(
+          ringer_node["chip"].as<std::string>("/dev/gpiochip0"),
+          ringer_node["line"].as<std::string>()));
     }
-  };
 
-  auto phone_num_util = i18n::phonenumbers::PhoneNumberUtil::GetInstance();
-
-  tg.startTransmit(playback);
-  std::unique_ptr<Call> active_call;
-
-  auto server_address = [&] {
-    auto uri = account->getInfo().uri;
-    auto at_sign = uri.find('@');
-    return uri.substr(at_sign + 1);
-  }();
-  for (;;) {
-    switch (state) {
-    case State::Hangup:
-      active_call.reset();
-      tg.stop();
-      [[fallthrough]];
-    case State::OnHook: {
-      auto event = dialer.wait_for_event(std::nullopt);
-      if (event.event != Dialer::Event::OffHook) {
-        continue;
-      }
-      state = State::DialTone;
-      break;
+    if (auto sidetone_node = line_node["sidetoneLevel"];
+        sidetone_node.IsScalar() && sidetone_node.Scalar() == "off") {
+      line->audio_device().set_sidetone_level(-INFINITY);
+    } else {
+      line->audio_device().set_sidetone_level(
+          sidetone_node.as<float>(-15.0f));
     }
-    case State::DialTone: {
-      pj::ToneDesc tone_desc;
-      tone_desc.freq1 = 350;
-      tone_desc.freq2 = 440;
-      tone_desc.on_msec = std::numeric_limits<short>::max();
-      tg.play(pj::ToneDescVector{tone_desc}, true);
-      number_to_dial.clear();
-      state = State::WaitingForNumber;
-      [[fallthrough]];
+    if (line_node["inbandDtmf"].as<bool>(false)) {
+      line->enable_inband_dtmf();
     }
-    case State::WaitingForNumber: {
-      auto event = dialer.wait_for_event(std::chrono::seconds{3});
-      if (event.event == Dialer::Event::OnHook) {
-        state = State::Hangup;
-        continue;
-      }
-
-      if (event.event == Dialer::Event::ButtonDown) {
-        push_digit(event.button);
-      } else if (event.event == Dialer::Event::WaitTimeout &&
-                 !number_to_dial.empty()) {
-        state = State::Dialing;
-        continue;
-      }
-
-      break;
+    if (routes) {
+      line->set_routing(routes, normalizer);
     }
-    case State::Dialing: {
-      tg.stop();
-      pj::ToneDesc tone_desc;
-      tone_desc.freq1 = 480;
-      tone_desc.freq2 = 440;
-      tone_desc.on_msec = 2000;
-      tone_desc.off_msec = 4000;
-      tg.play(pj::ToneDescVector{tone_desc}, true);
-      active_call = account->make_call();
-      std::stringstream ss;
-      ss << "sip:" << number_to_dial << "@" << server_address;
-      number_to_dial = ss.str();
-      active_call->makeCall(number_to_dial, {});
-      state = State::WaitingForAnswer;
-      break;
+    if (cdr_log) {
+      line->set_cdr_log(cdr_log);
+    }
+    if (recording_writer) {
+      line->enable_recording(recording_writer, recording_prefixes);
     }
-    case State::WaitingForAnswer: {
-      auto event = dialer.wait_for_event(std::nullopt);
-      if (event.event == Dialer::Event::OnHook) {
-        state = State::Hangup;
-        continue;
-      }
-
-      if (event.event != Dialer::Event::Interrupted) {
-        continue;
-      }
 
-      auto ci = active_call->get_state();
-      if (ci.state == PJSIP_INV_STATE_CONFIRMED) {
-        state = State::StartCall;
-      } else {
-        state = State::Hangup;
+    // Either one account or a list of them, most preferred first.
+    std::vector<YAML::Node> account_nodes;
+    if (auto accounts_node = line_node["accountConfig"];
+        accounts_node.IsSequence()) {
+      for (auto &&account_node : accounts_node) {
+        account_nodes.push_back(account_node);
       }
-      break;
+    } else {
+      account_nodes.push_back(accounts_node);
     }
-    case State::StartCall:
-      tg.stop();
-      [[fallthrough]];
-    case State::InCall: {
-      auto event = dialer.wait_for_event(std::nullopt);
-      if (event.event == Dialer::Event::OnHook) {
-        state = State::Hangup;
-      }
-      if (event.event == Dialer::Event::ButtonDown) {
-        push_digit(event.button);
+    for (size_t acc_idx = 0; acc_idx < account_nodes.size(); ++acc_idx) {
+      auto &account_node = account_nodes[acc_idx];
+      auto account_name = account_node["name"].as<std::string>(
+          "account" + std::to_string(acc_idx));
+      auto ac = read_config_object<pj::AccountConfig>(account_node,
+                                                      "AccountConfig");
+      if (transport_type != PJSIP_TRANSPORT_UDP) {
+        use_transport(ac, transport_id, transport_name);
       }
-      break;
-    }
-    case State::CallError:
-      tg.stop();
-      break;
+      line->add_account(ac, idx == 0 && acc_idx == 0,
+                        std::move(account_name));
     }
+    std::cout << "*** " << name << " added, RSS +"
+              << current_rss_kb() - rss_before << "kB" << std::endl;
+    lines.push_back(std::move(line));
+  }
+
+  std::cout << "*** Started, peak RSS " << peak_rss_kb() << "kB, pools "
+            << sip_pool_used_bytes() / 1024 << "kB, maxCalls "
+            << ep_config.uaConfig.maxCalls << ", bridge "
+            << ep_config.medConfig.maxMediaPorts << " ports" << std::endl;
+
+  if (transport_type != PJSIP_TRANSPORT_UDP) {
+    // Reconnect straight away rather than waiting for the registration
+    // retry timer.
+    ep.set_on_disconnected([&lines] {
+      for (auto &line : lines) {
+        line->reregister();
+      }
+    });
+  }
+
+  std::vector<std::thread> threads;
+  for (auto &line : lines) {
+    threads.emplace_back([&line] {
+      pj::Endpoint::instance().libRegisterThread(line->name());
+      Realtime::instance().enter_control_thread();
+      line->run();
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
   }
 
   return 0;
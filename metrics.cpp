@@ -0,0 +1,169 @@
+#include "metrics.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+constexpr size_t SubBuckets = size_t{1} << Histogram::SubBucketBits;
+
+void write_histogram(std::ostream &out, const char *name, const char *help,
+                     const Histogram &hist) {
+  out << "# HELP " << name << " " << help << "\n";
+  out << "# TYPE " << name << " histogram\n";
+  uint64_t cumulative = 0;
+  for (size_t idx = 0; idx < Histogram::NumBuckets; ++idx) {
+    auto count = hist.bucket_count(idx);
+    if (count == 0) {
+      continue;
+    }
+    cumulative += count;
+    out << name << "_bucket{le=\""
+        << static_cast<double>(Histogram::bucket_upper_bound(idx)) / 1e6
+        << "\"} " << cumulative << "\n";
+  }
+  // From the buckets rather than count(), which a concurrent record() bumps
+  // after its bucket, so the series can never go down at +Inf.
+  out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+  out << name << "_sum " << static_cast<double>(hist.sum()) / 1e6 << "\n";
+  out << name << "_count " << cumulative << "\n";
+}
+
+void write_counter(std::ostream &out, const char *name, const char *help,
+                   const Counter &counter) {
+  out << "# HELP " << name << " " << help << "\n";
+  out << "# TYPE " << name << " counter\n";
+  out << name << " " << counter.value() << "\n";
+}
+} // namespace
+
+size_t Histogram::bucket_for(uint64_t value) noexcept {
+  if (value < 2 * SubBuckets) {
+    return value;
+  }
+  size_t msb = 63 - __builtin_clzll(value);
+  size_t shift = msb - SubBucketBits;
+  size_t idx = (shift << SubBucketBits) + (value >> shift);
+  return idx < NumBuckets ? idx : NumBuckets - 1;
+}
+
+uint64_t Histogram::bucket_upper_bound(size_t idx) noexcept {
+  if (idx < 2 * SubBuckets) {
+    return idx;
+  }
+  size_t shift = (idx >> SubBucketBits) - 1;
+  uint64_t mantissa = (idx & (SubBuckets - 1)) + SubBuckets;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+Metrics &Metrics::instance() {
+  static Metrics metrics;
+  return metrics;
+}
+
+void Metrics::write_prometheus(std::ostream &out) const {
+  write_histogram(out, "payphone_key_to_tone_seconds",
+                  "Keypress to DTMF feedback tone latency", key_to_tone);
+  write_histogram(out, "payphone_digit_to_invite_seconds",
+                  "Last dialed digit to INVITE sent latency", digit_to_invite);
+  write_histogram(out, "payphone_call_setup_seconds",
+                  "INVITE sent to call confirmed latency", call_setup);
+  write_histogram(out, "payphone_registration_seconds",
+                  "REGISTER sent to registration state change latency",
+                  registration);
+  write_histogram(out, "payphone_keypad_scan_seconds",
+                  "Time taken to scan the keypad matrix for a key",
+                  keypad_scan);
+  write_histogram(out, "payphone_answer_seconds",
+                  "Off-hook to media connected for incoming calls", answer);
+  write_histogram(out, "payphone_sidetone_latency_seconds",
+                  "Microphone capture to sidetone playback in the device "
+                  "callbacks",
+                  sidetone_latency);
+  write_histogram(out, "payphone_line_cpu_seconds",
+                  "Line thread CPU time from one hangup to the next",
+                  line_cpu);
+  write_counter(out, "payphone_lost_digits_total",
+                "Digits pressed while the state machine couldn't use them",
+                lost_digits);
+  write_counter(out, "payphone_gpio_event_overflows_total",
+                "GPIO edge events dropped by the kernel event buffer",
+                gpio_event_overflows);
+  write_counter(out, "payphone_recording_overruns_total",
+                "Audio frames dropped because a recording fell behind",
+                recording_overruns);
+  write_counter(out, "payphone_recording_write_errors_total",
+                "Failed or short writes of call recordings",
+                recording_write_errors);
+  write_counter(out, "payphone_recording_failures_total",
+                "Recordings abandoned because their files could not be "
+                "written",
+                recording_failures);
+  write_counter(out, "payphone_cdr_dropped_total",
+                "Call detail records lost because the log was full",
+                cdr_dropped);
+
+  out << "# HELP payphone_calls_total Calls by final SIP status code\n";
+  out << "# TYPE payphone_calls_total counter\n";
+  for (size_t code = 0; code < m_calls_by_status.size(); ++code) {
+    if (auto value = m_calls_by_status[code].value(); value != 0) {
+      out << "payphone_calls_total{status_code=\"" << code << "\"} " << value
+          << "\n";
+    }
+  }
+}
+
+void Metrics::serve(std::filesystem::path path) {
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    int err = errno;
+    throw std::system_error(err, std::system_category());
+  }
+
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.native().size() >= sizeof(addr.sun_path)) {
+    ::close(fd);
+    throw std::runtime_error("Metrics socket path is too long");
+  }
+  path.native().copy(addr.sun_path, path.native().size());
+  ::unlink(path.c_str());
+  if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1 ||
+      ::listen(fd, 4) == -1) {
+    int err = errno;
+    ::close(fd);
+    throw std::system_error(err, std::system_category());
+  }
+
+  std::thread([this, fd] {
+    for (;;) {
+      int client = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client == -1) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        std::cerr << "*** Metrics socket accept failed: " << errno
+                  << std::endl;
+        return;
+      }
+
+      std::ostringstream ss;
+      write_prometheus(ss);
+      auto text = ss.str();
+      for (size_t written = 0; written < text.size();) {
+        auto rc = ::send(client, text.data() + written, text.size() - written,
+                         MSG_NOSIGNAL);
+        if (rc <= 0) {
+          break;
+        }
+        written += rc;
+      }
+      ::close(client);
+    }
+  }).detach();
+}
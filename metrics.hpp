@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+
+// Log-linear latency histogram in the style of HdrHistogram: values below 16
+// get their own bucket and every power of two above that is split into 8
+// sub-buckets, so any recorded value is within 12.5% of its bucket bound.
+// Recording is a couple of relaxed atomic adds and never blocks.
+class Histogram {
+public:
+  constexpr static size_t SubBucketBits = 3;
+  constexpr static size_t NumBuckets = 320;
+
+  void record(uint64_t value) noexcept {
+    m_buckets[bucket_for(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  template <typename Rep, typename Period>
+  void record(std::chrono::duration<Rep, Period> elapsed) noexcept {
+    // Clocks from different sources can put the end before the start.
+    auto us =
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    record(us > 0 ? static_cast<uint64_t>(us) : 0);
+  }
+
+  static size_t bucket_for(uint64_t value) noexcept;
+  // The largest value that lands in bucket idx.
+  static uint64_t bucket_upper_bound(size_t idx) noexcept;
+
+  uint64_t bucket_count(size_t idx) const noexcept {
+    return m_buckets[idx].load(std::memory_order_relaxed);
+  }
+  uint64_t count() const noexcept {
+    return m_count.load(std::memory_order_relaxed);
+  }
+  uint64_t sum() const noexcept {
+    return m_sum.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, NumBuckets> m_buckets{};
+  std::atomic<uint64_t> m_count{0};
+  std::atomic<uint64_t> m_sum{0};
+};
+
+class Counter {
+public:
+  void add(uint64_t value = 1) noexcept {
+    m_value.fetch_add(value, std::memory_order_relaxed);
+  }
+  uint64_t value() const noexcept {
+    return m_value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> m_value{0};
+};
+
+// Process wide metrics. Histograms are in microseconds.
+class Metrics {
+public:
+  static Metrics &instance();
+
+  Histogram key_to_tone;
+  Histogram digit_to_invite;
+  Histogram call_setup;
+  Histogram registration;
+  Histogram keypad_scan;
+  Histogram answer;
+  Histogram sidetone_latency;
+  Histogram line_cpu;
+
+  Counter lost_digits;
+  Counter gpio_event_overflows;
+  Counter recording_overruns;
+  Counter recording_write_errors;
+  Counter recording_failures;
+  Counter cdr_dropped;
+
+  void count_call(int status_code) noexcept {
+    if (status_code < 0 ||
+        static_cast<size_t>(status_code) >= m_calls_by_status.size()) {
+      status_code = 0;
+    }
+    m_calls_by_status[status_code].add();
+  }
+
+  void write_prometheus(std::ostream &out) const;
+
+  // Serves write_prometheus() to every client that connects to a unix
+  // domain socket at path, from a background thread.
+  void serve(std::filesystem::path path);
+
+private:
+  Metrics() = default;
+
+  std::array<Counter, 700> m_calls_by_status;
+};
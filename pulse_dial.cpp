@@ -0,0 +1,105 @@
+#include "pulse_dial.hpp"
+
+#include <algorithm>
+
+void PulseDialDecoder::hook_changed(bool loop_closed,
+                                    std::chrono::nanoseconds timestamp) {
+  if (loop_closed == m_loop_closed) {
+    return;
+  }
+  m_loop_closed = loop_closed;
+
+  if (!loop_closed) {
+    if (m_pulses != 0 && timestamp - m_last_make >= inter_digit()) {
+      finish_digit();
+    }
+    m_break_start = timestamp;
+    return;
+  }
+
+  auto break_len = timestamp - m_break_start;
+  if (!m_off_hook) {
+    m_pulses = 0;
+  } else if (break_len >= m_timing.on_hook) {
+    // poll() wasn't called in time to see the handset go down.
+    m_pulses = 0;
+    emit(Kind::OnHook, '\0', m_break_start);
+  } else if (break_len > m_timing.max_break) {
+    if (m_pulses != 0) {
+      finish_digit();
+    }
+    emit(Kind::HookFlash, '\0', m_break_start);
+  } else if (break_len >= m_timing.min_break) {
+    if (m_pulses++ == 0) {
+      m_first_pulse = m_break_start;
+    }
+  }
+  // Anything shorter than min_break is noise on the loop.
+
+  if (!m_off_hook || break_len >= m_timing.on_hook) {
+    m_off_hook = true;
+    emit(Kind::OffHook, '\0', timestamp);
+  }
+  m_last_make = timestamp;
+}
+
+std::optional<PulseDialDecoder::Output>
+PulseDialDecoder::poll(std::chrono::nanoseconds now) {
+  if (m_loop_closed && m_pulses != 0 && now - m_last_make >= inter_digit()) {
+    finish_digit();
+  } else if (!m_loop_closed && m_off_hook &&
+             now - m_break_start >= m_timing.on_hook) {
+    // Pulses that were cut off by hanging up don't make a digit.
+    m_pulses = 0;
+    m_off_hook = false;
+    emit(Kind::OnHook, '\0', m_break_start);
+  }
+
+  if (m_num_outputs == 0) {
+    return std::nullopt;
+  }
+  auto ret = m_outputs[0];
+  std::move(m_outputs.begin() + 1, m_outputs.begin() + m_num_outputs,
+            m_outputs.begin());
+  --m_num_outputs;
+  return ret;
+}
+
+std::optional<std::chrono::nanoseconds>
+PulseDialDecoder::next_deadline() const {
+  if (m_num_outputs != 0) {
+    return m_last_make;
+  }
+  if (m_loop_closed && m_pulses != 0) {
+    return m_last_make + inter_digit();
+  }
+  if (!m_loop_closed && m_off_hook) {
+    return m_break_start + std::chrono::nanoseconds{m_timing.on_hook};
+  }
+  return std::nullopt;
+}
+
+std::chrono::nanoseconds PulseDialDecoder::inter_digit() const {
+  std::chrono::nanoseconds period{0};
+  if (m_pulses != 0) {
+    period = (m_last_make - m_first_pulse) / m_pulses;
+  }
+  return std::max<std::chrono::nanoseconds>(m_timing.min_inter_digit,
+                                            2 * period);
+}
+
+void PulseDialDecoder::finish_digit() {
+  // Ten pulses is a zero; anything more is a misdial.
+  if (m_pulses <= 10) {
+    emit(Kind::Digit, "1234567890"[m_pulses - 1], m_last_make);
+  }
+  m_pulses = 0;
+}
+
+void PulseDialDecoder::emit(Kind kind, char digit,
+                            std::chrono::nanoseconds timestamp) {
+  if (m_num_outputs == m_outputs.size()) {
+    return;
+  }
+  m_outputs[m_num_outputs++] = {kind, digit, timestamp};
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <optional>
+
+struct PulseDialTiming {
+  // Breaks in the loop between these are dial pulses. A dial runs at about
+  // 10 pulses a second with the loop open for 60ms of each.
+  std::chrono::microseconds min_break{20000};
+  std::chrono::microseconds max_break{100000};
+  // Longer breaks than max_break are hook flashes, up to this long, after
+  // which the handset is on hook.
+  std::chrono::microseconds on_hook{1000000};
+  // The shortest pause after a digit's last pulse that ends the digit. Slow
+  // dials get at least twice their measured pulse period.
+  std::chrono::microseconds min_inter_digit{200000};
+};
+
+// Decodes a rotary dial from the debounced, timestamped edges of the hook
+// loop. Timing is taken entirely from the edge timestamps, so it doesn't
+// matter how late the edges are fed in as long as next_deadline() is used to
+// poll() for the outcomes that only time can decide.
+class PulseDialDecoder {
+public:
+  enum class Kind { Digit, HookFlash, OffHook, OnHook };
+
+  struct Output {
+    Kind kind;
+    char digit;
+    std::chrono::nanoseconds timestamp;
+  };
+
+  explicit PulseDialDecoder(PulseDialTiming timing, bool off_hook = false)
+      : m_timing(timing), m_off_hook(off_hook), m_loop_closed(off_hook) {}
+
+  void hook_changed(bool loop_closed, std::chrono::nanoseconds timestamp);
+
+  // Returns the next event that is certain by now, oldest first. Call until
+  // it returns nullopt.
+  std::optional<Output> poll(std::chrono::nanoseconds now);
+
+  std::optional<std::chrono::nanoseconds> next_deadline() const;
+
+private:
+  std::chrono::nanoseconds inter_digit() const;
+  void finish_digit();
+  void emit(Kind kind, char digit, std::chrono::nanoseconds timestamp);
+
+  PulseDialTiming m_timing;
+  // Whether the state machine has been told the handset is off hook.
+  bool m_off_hook;
+  bool m_loop_closed;
+  std::chrono::nanoseconds m_break_start{0};
+  std::chrono::nanoseconds m_last_make{0};
+  std::chrono::nanoseconds m_first_pulse{0};
+  int m_pulses = 0;
+
+  std::array<Output, 4> m_outputs;
+  size_t m_num_outputs = 0;
+};
@@ -0,0 +1,138 @@
+#include "realtime.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <utility>
+
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+void set_thread_class(pid_t tid, const ThreadClass &thread_class) {
+  if (!thread_class.cpus.empty()) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (auto cpu : thread_class.cpus) {
+      CPU_SET(cpu, &cpus);
+    }
+    if (::sched_setaffinity(tid, sizeof(cpus), &cpus) == -1) {
+      throw std::system_error(errno, std::system_category(),
+                              "sched_setaffinity");
+    }
+  }
+  if (thread_class.priority > 0) {
+    sched_param param = {};
+    param.sched_priority = thread_class.priority;
+    if (::sched_setscheduler(tid, SCHED_FIFO, &param) == -1) {
+      throw std::system_error(errno, std::system_category(),
+                              "sched_setscheduler");
+    }
+  }
+}
+
+void lock_memory(size_t prefault_kb) {
+  // On fault rather than up front: every thread's stack is 8MB of address
+  // space, which locking outright would make resident.
+  if (::mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) == -1) {
+    throw std::system_error(errno, std::system_category(), "mlockall");
+  }
+  // Freed memory goes back to malloc's free lists, which stay locked, and
+  // large blocks come from the heap too.
+  ::mallopt(M_TRIM_THRESHOLD, -1);
+  ::mallopt(M_MMAP_MAX, 0);
+  if (prefault_kb > 0) {
+    auto size = prefault_kb * 1024;
+    auto block = static_cast<char *>(std::malloc(size));
+    if (!block) {
+      // Only a head start; the heap still faults in and locks as it grows.
+      return;
+    }
+    auto page = ::sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < size; offset += page) {
+      static_cast<volatile char *>(block)[offset] = 0;
+    }
+    std::free(block);
+  }
+}
+
+void prefault_stack() {
+  constexpr size_t size = 128 * 1024;
+  char stack[size];
+  std::memset(stack, 0, size);
+  // Keeps the memset from being optimized away.
+  asm volatile("" : : "r"(stack) : "memory");
+}
+
+Realtime &Realtime::instance() {
+  static Realtime realtime;
+  return realtime;
+}
+
+void Realtime::configure(ThreadClass control, ThreadClass media, bool lock,
+                         size_t prefault_kb) {
+  m_control = std::move(control);
+  m_media = std::move(media);
+  m_enabled = true;
+  if (lock) {
+    try {
+      lock_memory(prefault_kb);
+    } catch (const std::system_error &e) {
+      std::cerr << "*** Memory stays unlocked: " << e.what() << std::endl;
+    }
+  }
+}
+
+void Realtime::enter_control_thread() noexcept {
+  if (!m_enabled) {
+    return;
+  }
+  try {
+    set_thread_class(0, m_control);
+    prefault_stack();
+  } catch (const std::system_error &e) {
+    std::cerr << "*** Control thread stays best effort: " << e.what()
+              << std::endl;
+  }
+}
+
+void Realtime::enter_media_thread() noexcept {
+  thread_local bool entered = false;
+  if (!m_enabled || entered) {
+    return;
+  }
+  entered = true;
+  try {
+    set_thread_class(0, m_media);
+    prefault_stack();
+  } catch (const std::system_error &e) {
+    std::cerr << "*** Media thread stays best effort: " << e.what()
+              << std::endl;
+  }
+}
+
+size_t Realtime::adopt_threads(const std::string &prefix) {
+  if (!m_enabled) {
+    return 0;
+  }
+  size_t count = 0;
+  for (auto &task : std::filesystem::directory_iterator("/proc/self/task")) {
+    std::string name;
+    std::getline(std::ifstream(task.path() / "comm"), name);
+    if (name.compare(0, prefix.size(), prefix) != 0) {
+      continue;
+    }
+    try {
+      set_thread_class(std::stoi(task.path().filename()), m_media);
+      ++count;
+    } catch (const std::system_error &e) {
+      std::cerr << "*** " << name << " stays best effort: " << e.what()
+                << std::endl;
+    }
+  }
+  return count;
+}
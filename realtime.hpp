@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+// How one class of threads is scheduled. A priority of 0 leaves the
+// scheduling policy alone; no cpus leaves the affinity alone.
+struct ThreadClass {
+  int priority = 0;
+  std::vector<int> cpus;
+};
+
+// Puts thread tid, or the calling thread if 0, under SCHED_FIFO at
+// priority and on cpus, as given by thread_class.
+void set_thread_class(pid_t tid, const ThreadClass &thread_class);
+
+// Locks every page the process touches from now on into memory, keeps
+// freed heap memory instead of returning it to the kernel, and faults in
+// prefault_kb of heap up front.
+void lock_memory(size_t prefault_kb);
+
+// Touches the top of the calling thread's stack so it is resident.
+void prefault_stack();
+
+// Realtime mode. The line threads run the state machine and poll the
+// dialer; the media threads are the sound device callbacks and pjmedia's
+// own workers.
+class Realtime {
+public:
+  static Realtime &instance();
+
+  // Call before the lines start their threads and sound devices, which read
+  // the settings without locking. Failing to lock memory is logged, not
+  // thrown.
+  void configure(ThreadClass control, ThreadClass media, bool lock,
+                 size_t prefault_kb);
+  bool enabled() const noexcept { return m_enabled; }
+
+  // Called at the start of every line thread. Without the privileges for
+  // it, the thread carries on under the normal scheduler.
+  void enter_control_thread() noexcept;
+
+  // Called from every sound device callback. Sets the calling thread up the
+  // first time and does nothing after that.
+  void enter_media_thread() noexcept;
+
+  // Applies the media class to the existing threads whose names start with
+  // prefix, and returns how many it could.
+  size_t adopt_threads(const std::string &prefix);
+
+private:
+  Realtime() = default;
+
+  bool m_enabled = false;
+  ThreadClass m_control;
+  ThreadClass m_media;
+};
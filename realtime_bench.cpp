@@ -0,0 +1,146 @@
+#include "realtime.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <time.h>
+
+// Wakeup latency of a periodic thread, like the keypad scan or a sound
+// device callback, while every CPU is kept busy. Runs once as an ordinary
+// thread and once in realtime mode, SCHED_FIFO on one CPU with memory
+// locked, and prints the lateness distribution of each.
+//
+//   realtime_bench [--seconds 10] [--period-us 1000] [--stress THREADS]
+//                  [--priority 80] [--cpu 0]
+//
+// The realtime run needs root, CAP_SYS_NICE and CAP_IPC_LOCK, or an rtprio
+// and memlock limit.
+namespace {
+struct Options {
+  int seconds = 10;
+  int period_us = 1000;
+  int stress = static_cast<int>(std::thread::hardware_concurrency());
+  ThreadClass realtime = {80, {0}};
+};
+
+// Burns CPU and churns the allocator, which is what the media and SIP
+// threads do to the control thread's CPU.
+void stress(const std::atomic<bool> &stop) {
+  std::vector<std::vector<double>> blocks;
+  double acc = 0;
+  for (uint64_t idx = 0; !stop.load(std::memory_order_relaxed); ++idx) {
+    acc += std::sqrt(static_cast<double>(idx));
+    if (idx % 4096 == 0) {
+      blocks.emplace_back(1024, acc);
+      if (blocks.size() > 64) {
+        blocks.erase(blocks.begin());
+      }
+    }
+  }
+  asm volatile("" : : "g"(&acc) : "memory");
+}
+
+// Sleeps until each period boundary and returns how late every wakeup was,
+// in nanoseconds.
+std::vector<int64_t> measure(const Options &options) {
+  auto period = std::chrono::microseconds{options.period_us};
+  size_t wakeups = std::chrono::seconds{options.seconds} / period;
+  std::vector<int64_t> late;
+  late.reserve(wakeups);
+
+  timespec next;
+  ::clock_gettime(CLOCK_MONOTONIC, &next);
+  for (size_t idx = 0; idx < wakeups; ++idx) {
+    next.tv_nsec += options.period_us * 1000;
+    while (next.tv_nsec >= 1000000000) {
+      next.tv_nsec -= 1000000000;
+      ++next.tv_sec;
+    }
+    ::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+    timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    late.push_back((now.tv_sec - next.tv_sec) * 1000000000 +
+                   (now.tv_nsec - next.tv_nsec));
+  }
+  return late;
+}
+
+void report(const std::string &name, std::vector<int64_t> late) {
+  std::sort(late.begin(), late.end());
+  auto pct = [&](double fraction) {
+    return late[static_cast<size_t>((late.size() - 1) * fraction)] / 1000.0;
+  };
+  std::cout << name << ": " << late.size() << " wakeups, late p50 "
+            << pct(0.5) << "us, p99 " << pct(0.99) << "us, p99.9 "
+            << pct(0.999) << "us, max " << pct(1.0) << "us" << std::endl;
+}
+
+void run(const std::string &name, const Options &options, bool realtime) {
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> stressors;
+  for (int idx = 0; idx < options.stress; ++idx) {
+    stressors.emplace_back([&stop] { stress(stop); });
+  }
+
+  std::vector<int64_t> late;
+  std::string error;
+  std::thread measurer([&] {
+    try {
+      if (realtime) {
+        lock_memory(0);
+        set_thread_class(0, options.realtime);
+        prefault_stack();
+      }
+      late = measure(options);
+    } catch (const std::system_error &e) {
+      error = e.what();
+    }
+  });
+  measurer.join();
+  stop = true;
+  for (auto &thread : stressors) {
+    thread.join();
+  }
+
+  if (!error.empty()) {
+    std::cout << name << ": skipped, " << error << std::endl;
+  } else {
+    report(name, std::move(late));
+  }
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int idx = 1; idx + 1 < argc; idx += 2) {
+    std::string arg = argv[idx];
+    if (arg == "--seconds") {
+      options.seconds = std::atoi(argv[idx + 1]);
+    } else if (arg == "--period-us") {
+      options.period_us = std::atoi(argv[idx + 1]);
+    } else if (arg == "--stress") {
+      options.stress = std::atoi(argv[idx + 1]);
+    } else if (arg == "--priority") {
+      options.realtime.priority = std::atoi(argv[idx + 1]);
+    } else if (arg == "--cpu") {
+      options.realtime.cpus = {std::atoi(argv[idx + 1])};
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      return 2;
+    }
+  }
+
+  std::cout << options.stress << " stress threads, " << options.period_us
+            << "us period" << std::endl;
+  run("normal", options, false);
+  run("realtime", options, true);
+  return 0;
+}
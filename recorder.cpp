@@ -0,0 +1,518 @@
+#include "recorder.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Queue of block writes. Completions come back tagged, in any order.
+class DiskQueue {
+public:
+  struct Completion {
+    uint64_t tag;
+    int32_t result;
+  };
+
+  virtual ~DiskQueue() = default;
+
+  // Returns false if the queue is full; try again after reap().
+  virtual bool submit(int fd, const void *buf, size_t len, uint64_t offset,
+                      uint64_t tag) = 0;
+  virtual void flush() = 0;
+  virtual size_t reap(Completion *out, size_t max) = 0;
+  virtual const char *name() const noexcept = 0;
+};
+
+namespace {
+constexpr size_t header_size = 4096;
+
+void throw_errno() {
+  int err = errno;
+  throw std::system_error(err, std::system_category());
+}
+
+class PwriteQueue : public DiskQueue {
+public:
+  bool submit(int fd, const void *buf, size_t len, uint64_t offset,
+              uint64_t tag) override {
+    if (m_num_done == m_done.size()) {
+      return false;
+    }
+    auto rc = ::pwrite(fd, buf, len, offset);
+    m_done[m_num_done++] = {tag, static_cast<int32_t>(rc < 0 ? -errno : rc)};
+    return true;
+  }
+
+  void flush() override {}
+
+  size_t reap(Completion *out, size_t max) override {
+    auto count = std::min(max, m_num_done);
+    std::copy(m_done.begin(), m_done.begin() + count, out);
+    std::copy(m_done.begin() + count, m_done.begin() + m_num_done,
+              m_done.begin());
+    m_num_done -= count;
+    return count;
+  }
+
+  const char *name() const noexcept override { return "pwrite"; }
+
+private:
+  std::array<Completion, 256> m_done;
+  size_t m_num_done = 0;
+};
+
+// Just enough of io_uring to queue writes and collect their completions,
+// straight on the kernel ABI.
+class IoUringQueue : public DiskQueue {
+public:
+  explicit IoUringQueue(unsigned entries) {
+    io_uring_params params = {};
+    m_fd = ::syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd == -1) {
+      throw_errno();
+    }
+
+    m_sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+    }
+    m_sq_ring = map(m_sq_size, IORING_OFF_SQ_RING);
+    m_cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP)
+                    ? m_sq_ring
+                    : map(m_cq_size, IORING_OFF_CQ_RING);
+    m_sqes = static_cast<io_uring_sqe *>(
+        map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    auto sq = static_cast<uint8_t *>(m_sq_ring);
+    m_sq_head = reinterpret_cast<uint32_t *>(sq + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<uint32_t *>(sq + params.sq_off.tail);
+    m_sq_mask = *reinterpret_cast<uint32_t *>(sq + params.sq_off.ring_mask);
+    m_sq_entries = params.sq_entries;
+    m_sq_array = reinterpret_cast<uint32_t *>(sq + params.sq_off.array);
+
+    auto cq = static_cast<uint8_t *>(m_cq_ring);
+    m_cq_head = reinterpret_cast<uint32_t *>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<uint32_t *>(cq + params.cq_off.tail);
+    m_cq_mask = *reinterpret_cast<uint32_t *>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    m_cq_entries = params.cq_entries;
+  }
+
+  ~IoUringQueue() override {
+    ::munmap(m_sqes, m_sqes_size);
+    if (m_cq_ring != m_sq_ring) {
+      ::munmap(m_cq_ring, m_cq_size);
+    }
+    ::munmap(m_sq_ring, m_sq_size);
+    ::close(m_fd);
+  }
+
+  bool submit(int fd, const void *buf, size_t len, uint64_t offset,
+              uint64_t tag) override {
+    // Never have more writes outstanding than the completion ring holds.
+    if (m_in_flight + m_unsubmitted == m_cq_entries) {
+      return false;
+    }
+    auto tail = *m_sq_tail;
+    if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) == m_sq_entries) {
+      flush();
+      if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) ==
+          m_sq_entries) {
+        return false;
+      }
+    }
+    auto idx = tail & m_sq_mask;
+    auto &sqe = m_sqes[idx];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITE;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buf);
+    sqe.len = len;
+    sqe.off = offset;
+    sqe.user_data = tag;
+    m_sq_array[idx] = idx;
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++m_unsubmitted;
+    return true;
+  }
+
+  void flush() override {
+    while (m_unsubmitted != 0) {
+      auto rc = ::syscall(__NR_io_uring_enter, m_fd, m_unsubmitted, 0, 0,
+                          nullptr, 0);
+      if (rc == -1) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+          return;
+        }
+        throw_errno();
+      }
+      m_unsubmitted -= rc;
+      m_in_flight += rc;
+    }
+  }
+
+  size_t reap(Completion *out, size_t max) override {
+    auto head = *m_cq_head;
+    auto tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+    for (; head != tail && count < max; ++head, ++count) {
+      auto &cqe = m_cqes[head & m_cq_mask];
+      out[count] = {cqe.user_data, cqe.res};
+    }
+    __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    m_in_flight -= count;
+    return count;
+  }
+
+  const char *name() const noexcept override { return "io_uring"; }
+
+private:
+  void *map(size_t len, off_t offset) {
+    auto ptr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, m_fd, offset);
+    if (ptr == MAP_FAILED) {
+      throw_errno();
+    }
+    return ptr;
+  }
+
+  int m_fd = -1;
+  void *m_sq_ring = nullptr;
+  void *m_cq_ring = nullptr;
+  size_t m_sq_size = 0;
+  size_t m_cq_size = 0;
+  io_uring_sqe *m_sqes = nullptr;
+  size_t m_sqes_size = 0;
+  uint32_t *m_sq_head;
+  uint32_t *m_sq_tail;
+  uint32_t *m_sq_array;
+  uint32_t m_sq_mask;
+  uint32_t m_sq_entries;
+  uint32_t *m_cq_head;
+  uint32_t *m_cq_tail;
+  io_uring_cqe *m_cqes;
+  uint32_t m_cq_mask;
+  uint32_t m_cq_entries;
+  uint32_t m_unsubmitted = 0;
+  uint32_t m_in_flight = 0;
+};
+
+// RIFF header for 16-bit mono PCM, padded with a JUNK chunk so the samples
+// start at header_size.
+void write_wav_header(uint8_t *out, unsigned clock_rate, uint64_t data_bytes) {
+  auto put32 = [&](size_t offset, uint32_t value) {
+    std::memcpy(out + offset, &value, sizeof(value));
+  };
+  auto put16 = [&](size_t offset, uint16_t value) {
+    std::memcpy(out + offset, &value, sizeof(value));
+  };
+  std::memset(out, 0, header_size);
+  std::memcpy(out, "RIFF", 4);
+  put32(4, header_size - 8 + data_bytes);
+  std::memcpy(out + 8, "WAVEfmt ", 8);
+  put32(16, 16);
+  put16(20, 1);
+  put16(22, 1);
+  put32(24, clock_rate);
+  put32(28, clock_rate * 2);
+  put16(32, 2);
+  put16(34, 16);
+  std::memcpy(out + 36, "JUNK", 4);
+  put32(40, header_size - 44 - 8);
+  std::memcpy(out + header_size - 8, "data", 4);
+  put32(header_size - 4, data_bytes);
+}
+} // namespace
+
+Recording::Recording(std::string name, unsigned clock_rate)
+    : m_name(std::move(name)), m_clock_rate(clock_rate),
+      m_ring(static_cast<uint8_t *>(
+          std::aligned_alloc(block_size, ring_size))) {
+  if (!m_ring) {
+    throw std::bad_alloc();
+  }
+  // Fault the ring in now rather than on the media thread.
+  std::memset(m_ring, 0, ring_size);
+}
+
+Recording::~Recording() { std::free(m_ring); }
+
+void Recording::push(const void *data, size_t len) noexcept {
+  auto head = m_head.load(std::memory_order_relaxed);
+  if (head + len - m_freed.load(std::memory_order_acquire) > ring_size) {
+    Metrics::instance().recording_overruns.add();
+    return;
+  }
+  auto pos = head % ring_size;
+  auto first = std::min(len, ring_size - pos);
+  std::memcpy(m_ring + pos, data, first);
+  std::memcpy(m_ring, static_cast<const uint8_t *>(data) + first, len - first);
+  m_head.store(head + len, std::memory_order_release);
+}
+
+RecordingWriter::RecordingWriter(std::filesystem::path directory,
+                                 std::chrono::seconds segment_length)
+    : m_directory(std::move(directory)), m_segment_length(segment_length) {
+  std::filesystem::create_directories(m_directory);
+  try {
+    m_queue = std::make_unique<IoUringQueue>(256);
+  } catch (const std::system_error &e) {
+    // Old kernels, and seccomp profiles that block io_uring.
+    std::cout << "*** io_uring unavailable (" << e.what()
+              << "), recording with pwrite" << std::endl;
+    m_queue = std::make_unique<PwriteQueue>();
+  }
+  m_thread = std::thread([this] { run(); });
+}
+
+RecordingWriter::~RecordingWriter() {
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_exit = true;
+  }
+  m_cond.notify_one();
+  m_thread.join();
+}
+
+const char *RecordingWriter::backend() const noexcept {
+  return m_queue->name();
+}
+
+std::shared_ptr<Recording> RecordingWriter::start(std::string name,
+                                                  unsigned clock_rate) {
+  std::shared_ptr<Recording> recording(
+      new Recording(std::move(name), clock_rate));
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_started.push_back(recording);
+  return recording;
+}
+
+void RecordingWriter::stop(const std::shared_ptr<Recording> &recording) {
+  recording->m_stopping.store(true, std::memory_order_release);
+  m_cond.notify_one();
+}
+
+void RecordingWriter::run() {
+  std::array<DiskQueue::Completion, 64> completions;
+  for (;;) {
+    bool exiting;
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      exiting = m_exit;
+      for (auto &recording : m_started) {
+        m_active.push_back(std::move(recording));
+      }
+      m_started.clear();
+    }
+    if (exiting) {
+      for (auto &recording : m_active) {
+        recording->m_stopping.store(true, std::memory_order_release);
+      }
+    }
+
+    bool busy = false;
+    for (auto &recording : m_active) {
+      try {
+        busy |= recording->m_failed ? discard(*recording) : pump(*recording);
+      } catch (const std::system_error &e) {
+        fail(*recording, e);
+      }
+    }
+    try {
+      m_queue->flush();
+    } catch (const std::system_error &e) {
+      // What was queued stays queued; try again next time round.
+      Metrics::instance().recording_write_errors.add();
+      std::cout << "*** Recording writes failed: " << e.what() << std::endl;
+      busy = false;
+    }
+    while (auto count = m_queue->reap(completions.data(), completions.size())) {
+      for (size_t idx = 0; idx < count; ++idx) {
+        complete(completions[idx].tag, completions[idx].result);
+      }
+      busy = true;
+    }
+    m_active.erase(std::remove_if(m_active.begin(), m_active.end(),
+                                  [&](const auto &recording) {
+                                    return finish(*recording);
+                                  }),
+                   m_active.end());
+
+    if (exiting && m_active.empty()) {
+      return;
+    }
+    if (!busy) {
+      // A 4kB block is 128ms of 16kHz audio, so there's no hurry.
+      std::unique_lock<std::mutex> lk(m_mutex);
+      m_cond.wait_for(lk, std::chrono::milliseconds{20});
+    }
+  }
+}
+
+// Hands every full block, and a stopped recording's last partial one, to the
+// disk queue. Returns whether it submitted anything.
+bool RecordingWriter::pump(Recording &recording) {
+  bool submitted = false;
+  for (;;) {
+    auto head = recording.m_head.load(std::memory_order_acquire);
+    auto pending = head - recording.m_submitted;
+    bool stopping = recording.m_stopping.load(std::memory_order_acquire);
+    if (pending == 0 || (pending < Recording::block_size && !stopping)) {
+      return submitted;
+    }
+
+    uint64_t segment_bytes = static_cast<uint64_t>(m_segment_length.count()) *
+                             recording.m_clock_rate * 2;
+    if (!recording.m_segment ||
+        recording.m_segment->data_bytes >= segment_bytes) {
+      open_segment(recording);
+    }
+
+    auto len = std::min<uint64_t>(pending, Recording::block_size);
+    auto block = recording.m_submitted / Recording::block_size %
+                 Recording::num_blocks;
+    auto data = recording.m_ring + block * Recording::block_size;
+    if (len < Recording::block_size) {
+      // The producer has stopped, so the rest of the block is ours.
+      std::memset(data + len, 0, Recording::block_size - len);
+    }
+
+    auto &segment = *recording.m_segment;
+    recording.m_blocks[block] = {&recording, &segment};
+    if (!m_queue->submit(segment.fd, data, Recording::block_size,
+                         header_size + segment.data_bytes,
+                         reinterpret_cast<uint64_t>(
+                             &recording.m_blocks[block]))) {
+      return submitted;
+    }
+    ++segment.in_flight;
+    segment.data_bytes += len;
+    recording.m_submitted += len;
+    submitted = true;
+  }
+}
+
+// A failed recording's audio is thrown away as it arrives, once the writes
+// already in flight have come back. Returns whether it dropped anything.
+bool RecordingWriter::discard(Recording &recording) {
+  auto head = recording.m_head.load(std::memory_order_acquire);
+  if (recording.m_freed.load(std::memory_order_relaxed) !=
+          recording.m_submitted ||
+      head == recording.m_submitted) {
+    return false;
+  }
+  recording.m_submitted = head;
+  recording.m_freed.store(head, std::memory_order_release);
+  return true;
+}
+
+// Gives up on writing recording, but keeps the call and the writer going.
+void RecordingWriter::fail(Recording &recording,
+                           const std::system_error &error) {
+  Metrics::instance().recording_failures.add();
+  std::cout << "*** Recording " << recording.m_name
+            << " abandoned: " << error.what() << std::endl;
+  recording.m_failed = true;
+  if (recording.m_segment) {
+    recording.m_closing.push_back(std::move(recording.m_segment));
+  }
+}
+
+void RecordingWriter::complete(uint64_t tag, int32_t result) {
+  auto &block = *reinterpret_cast<Recording::Block *>(tag);
+  auto &recording = *block.recording;
+  --block.segment->in_flight;
+  if (result != static_cast<int32_t>(Recording::block_size)) {
+    Metrics::instance().recording_write_errors.add();
+  }
+
+  // Give blocks back to the producer in order, however they completed.
+  auto idx = &block - recording.m_blocks.data();
+  auto freed = recording.m_freed.load(std::memory_order_relaxed);
+  auto first = freed / Recording::block_size % Recording::num_blocks;
+  recording.m_done_mask |=
+      uint64_t{1} << ((idx + Recording::num_blocks - first) %
+                      Recording::num_blocks);
+  while (recording.m_done_mask & 1) {
+    recording.m_done_mask >>= 1;
+    freed += Recording::block_size;
+  }
+  recording.m_freed.store(freed, std::memory_order_release);
+}
+
+// Closes the segments that have been rotated out once their writes are done,
+// and a stopped recording's last one once everything is on disk. Returns
+// whether the recording is done with.
+bool RecordingWriter::finish(Recording &recording) {
+  if (recording.m_stopping.load(std::memory_order_acquire) &&
+      recording.m_submitted ==
+          recording.m_head.load(std::memory_order_acquire) &&
+      recording.m_segment) {
+    recording.m_closing.push_back(std::move(recording.m_segment));
+  }
+  auto &closing = recording.m_closing;
+  for (auto it = closing.begin(); it != closing.end();) {
+    if ((*it)->in_flight == 0) {
+      close_segment(recording, **it);
+      it = closing.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return recording.m_stopping.load(std::memory_order_acquire) &&
+         !recording.m_segment && closing.empty() &&
+         recording.m_submitted ==
+             recording.m_head.load(std::memory_order_acquire);
+}
+
+void RecordingWriter::open_segment(Recording &recording) {
+  if (recording.m_segment) {
+    recording.m_closing.push_back(std::move(recording.m_segment));
+  }
+  auto segment = std::make_unique<Recording::Segment>();
+  segment->path = m_directory / (recording.m_name + "-" +
+                                 std::to_string(recording.m_next_segment++) +
+                                 ".wav");
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  segment->fd = ::open(segment->path.c_str(), flags | O_DIRECT, 0644);
+  if (segment->fd == -1 && errno == EINVAL) {
+    // tmpfs and some others don't do O_DIRECT.
+    segment->fd = ::open(segment->path.c_str(), flags, 0644);
+  }
+  if (segment->fd == -1) {
+    throw_errno();
+  }
+  recording.m_segment = std::move(segment);
+  close_segment(recording, *recording.m_segment);
+}
+
+// Writes the header with the sizes so far. Only actually closes the file once
+// nothing more is going to be written to it.
+void RecordingWriter::close_segment(Recording &recording,
+                                    Recording::Segment &segment) {
+  alignas(header_size) static uint8_t header[header_size];
+  write_wav_header(header, recording.m_clock_rate, segment.data_bytes);
+  if (::pwrite(segment.fd, header, header_size, 0) != header_size) {
+    Metrics::instance().recording_write_errors.add();
+  }
+  if (&segment == recording.m_segment.get()) {
+    return;
+  }
+  // The last block was padded out to the block size.
+  if (::ftruncate(segment.fd, header_size + segment.data_bytes) == -1) {
+    Metrics::instance().recording_write_errors.add();
+  }
+  ::close(segment.fd);
+  segment.fd = -1;
+}
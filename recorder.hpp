@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+class DiskQueue;
+
+// One call being recorded as 16-bit mono PCM. The media thread push()es
+// frames into a ring of 4kB blocks; the RecordingWriter thread hands full
+// blocks straight from the ring to the kernel and only gives them back to the
+// producer once the write has completed, so audio is never copied after it
+// leaves the media thread.
+class Recording {
+public:
+  ~Recording();
+
+  // Media thread. Never blocks: a frame that doesn't fit is dropped and
+  // counted in payphone_recording_overruns_total. Must not be called once
+  // the recording has been stopped.
+  void push(const void *data, size_t len) noexcept;
+
+  const std::string &name() const noexcept { return m_name; }
+
+private:
+  friend class RecordingWriter;
+
+  constexpr static size_t block_size = 4096;
+  constexpr static size_t num_blocks = 64;
+  constexpr static size_t ring_size = block_size * num_blocks;
+
+  struct Segment {
+    std::filesystem::path path;
+    int fd = -1;
+    uint64_t data_bytes = 0;
+    int in_flight = 0;
+  };
+
+  // What each block of the ring is being written to while it's in flight.
+  struct Block {
+    Recording *recording;
+    Segment *segment;
+  };
+
+  Recording(std::string name, unsigned clock_rate);
+
+  std::string m_name;
+  unsigned m_clock_rate;
+  uint8_t *m_ring;
+  // Bytes pushed by the producer and bytes the writer has finished with.
+  std::atomic<uint64_t> m_head{0};
+  std::atomic<uint64_t> m_freed{0};
+  std::atomic<bool> m_stopping{false};
+
+  // Writer thread only.
+  // Set once a segment can't be written; the rest of the audio is dropped.
+  bool m_failed = false;
+  uint64_t m_submitted = 0;
+  // Blocks past m_freed that completed out of order.
+  uint64_t m_done_mask = 0;
+  unsigned m_next_segment = 0;
+  std::unique_ptr<Segment> m_segment;
+  std::vector<std::unique_ptr<Segment>> m_closing;
+  std::array<Block, num_blocks> m_blocks;
+};
+
+// Writes every active Recording to WAV segments from a single background
+// thread, through io_uring when the kernel allows it and O_DIRECT pwrite()
+// otherwise. Each segment starts with a 4kB header block so the audio after
+// it stays block aligned; the header is rewritten with the final sizes when
+// the segment is closed.
+class RecordingWriter {
+public:
+  RecordingWriter(std::filesystem::path directory,
+                  std::chrono::seconds segment_length);
+  ~RecordingWriter();
+
+  std::shared_ptr<Recording> start(std::string name, unsigned clock_rate);
+  // The recording is flushed and closed in the background once everything
+  // pushed so far is on disk.
+  void stop(const std::shared_ptr<Recording> &recording);
+
+  // "io_uring" or "pwrite".
+  const char *backend() const noexcept;
+
+private:
+  void run();
+  bool pump(Recording &recording);
+  bool discard(Recording &recording);
+  void fail(Recording &recording, const std::system_error &error);
+  void complete(uint64_t tag, int32_t result);
+  bool finish(Recording &recording);
+  void open_segment(Recording &recording);
+  void close_segment(Recording &recording, Recording::Segment &segment);
+
+  std::filesystem::path m_directory;
+  std::chrono::seconds m_segment_length;
+  std::unique_ptr<DiskQueue> m_queue;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  bool m_exit = false;
+  std::vector<std::shared_ptr<Recording>> m_started;
+
+  // Writer thread only.
+  std::vector<std::shared_ptr<Recording>> m_active;
+  std::thread m_thread;
+};
@@ -0,0 +1,97 @@
+#include "metrics.hpp"
+#include "recorder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Records many calls at once from a single thread standing in for the media
+// thread: every 20ms it pushes one frame to each recording, the way the
+// conference bridge would. Reports what push() costs the media thread, how
+// many frames were dropped, and checks that everything pushed made it into
+// the segments on disk.
+//
+//   recorder_bench [recordings] [seconds] [directory]
+int main(int argc, char **argv) {
+  size_t num_recordings = argc > 1 ? std::atoi(argv[1]) : 64;
+  int seconds = argc > 2 ? std::atoi(argv[2]) : 10;
+  std::filesystem::path directory =
+      argc > 3 ? argv[3] : "/tmp/recorder_bench";
+
+  constexpr unsigned clock_rate = 16000;
+  constexpr unsigned frame = clock_rate / 50;
+  constexpr auto period = std::chrono::milliseconds{20};
+  const int frames = seconds * 50;
+
+  std::filesystem::remove_all(directory);
+  uint64_t pushed = 0;
+  std::chrono::nanoseconds worst_push{0}, worst_tick{0}, total{0};
+  const char *backend;
+  auto began = std::chrono::steady_clock::now();
+  {
+    RecordingWriter writer(directory, std::chrono::seconds{4});
+    backend = writer.backend();
+    std::vector<std::shared_ptr<Recording>> recordings;
+    for (size_t idx = 0; idx < num_recordings; ++idx) {
+      recordings.push_back(
+          writer.start("call" + std::to_string(idx), clock_rate));
+    }
+
+    std::vector<int16_t> pcm(frame);
+    auto start = std::chrono::steady_clock::now();
+    for (int tick = 0; tick < frames; ++tick) {
+      std::this_thread::sleep_until(start + tick * period);
+      for (size_t idx = 0; idx < pcm.size(); ++idx) {
+        pcm[idx] = (tick * frame + idx) & 0x7fff;
+      }
+      auto tick_begin = std::chrono::steady_clock::now();
+      for (auto &recording : recordings) {
+        auto begin = std::chrono::steady_clock::now();
+        recording->push(pcm.data(), pcm.size() * sizeof(int16_t));
+        auto end = std::chrono::steady_clock::now();
+        worst_push = std::max<std::chrono::nanoseconds>(worst_push,
+                                                        end - begin);
+      }
+      auto tick_cost = std::chrono::steady_clock::now() - tick_begin;
+      worst_tick = std::max<std::chrono::nanoseconds>(worst_tick, tick_cost);
+      total += tick_cost;
+      pushed += pcm.size() * sizeof(int16_t) * recordings.size();
+    }
+    for (auto &recording : recordings) {
+      writer.stop(recording);
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - began;
+
+  uint64_t on_disk = 0;
+  size_t segments = 0;
+  for (auto &entry : std::filesystem::directory_iterator(directory)) {
+    on_disk += entry.file_size() - 4096;
+    ++segments;
+  }
+
+  auto &metrics = Metrics::instance();
+  auto overruns = metrics.recording_overruns.value();
+  auto dropped = overruns * frame * sizeof(int16_t);
+  std::cout << "backend " << backend << "\n"
+            << "recordings " << num_recordings << ", " << frames
+            << " frames each, " << segments << " segments\n"
+            << "push mean "
+            << total.count() / (uint64_t(frames) * num_recordings)
+            << "ns, worst " << worst_push.count() << "ns\n"
+            << "worst media tick " << worst_tick.count() / 1000 << "us\n"
+            << "overruns " << overruns << ", write errors "
+            << metrics.recording_write_errors.value() << "\n"
+            << "throughput "
+            << pushed * 1e3 / std::max<int64_t>(elapsed.count(), 1)
+            << " MB/s\n";
+  if (on_disk + dropped != pushed) {
+    std::cout << "FAIL: pushed " << pushed << " bytes, " << on_disk
+              << " on disk, " << dropped << " dropped" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,42 @@
+#include "recorder_port.hpp"
+
+#include <stdexcept>
+
+RecorderPort::RecorderPort(RecordingWriter &writer, std::string name)
+    : m_writer(writer) {
+  pjsua_conf_port_info master_info;
+  if (pjsua_conf_get_port_info(0, &master_info) != PJ_SUCCESS) {
+    throw std::runtime_error("Could not get conference bridge format");
+  }
+  if (master_info.channel_count != 1 || master_info.bits_per_sample != 16) {
+    throw std::runtime_error("Can only record 16-bit mono audio");
+  }
+  m_recording = m_writer.start(std::move(name), master_info.clock_rate);
+
+  m_pool = pjsua_pool_create("recorder", 512, 512);
+  pj_str_t port_name = pj_str(const_cast<char *>("recorder"));
+  pjmedia_port_info_init(&m_port.info, &port_name,
+                         PJMEDIA_SIG_CLASS_APP('P', 'R'),
+                         master_info.clock_rate, master_info.channel_count,
+                         master_info.bits_per_sample,
+                         master_info.samples_per_frame);
+  m_port.port_data.pdata = this;
+  m_port.put_frame = &RecorderPort::on_put_frame;
+  registerMediaPort2(&m_port, m_pool);
+}
+
+RecorderPort::~RecorderPort() {
+  // Off the bridge first so no frame can be pushed after the stop.
+  unregisterMediaPort();
+  m_writer.stop(m_recording);
+  pj_pool_release(m_pool);
+}
+
+pj_status_t RecorderPort::on_put_frame(pjmedia_port *port,
+                                       pjmedia_frame *frame) {
+  auto self = static_cast<RecorderPort *>(port->port_data.pdata);
+  if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO) {
+    self->m_recording->push(frame->buf, frame->size);
+  }
+  return PJ_SUCCESS;
+}
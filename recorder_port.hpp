@@ -0,0 +1,29 @@
+#pragma once
+
+#include "recorder.hpp"
+
+#include <memory>
+#include <string>
+
+#include <pjsua2.hpp>
+
+// Records whatever the conference bridge transmits to it, which for a call is
+// both directions mixed together. A bare pjmedia_port on the bridge, so
+// frames go from the bridge's buffer into the recording's ring without being
+// copied anywhere else. The recording is stopped when the port is destroyed.
+class RecorderPort : public pj::AudioMedia {
+public:
+  RecorderPort(RecordingWriter &writer, std::string name);
+  ~RecorderPort();
+
+  RecorderPort(const RecorderPort &) = delete;
+  RecorderPort &operator=(const RecorderPort &) = delete;
+
+private:
+  static pj_status_t on_put_frame(pjmedia_port *port, pjmedia_frame *frame);
+
+  RecordingWriter &m_writer;
+  std::shared_ptr<Recording> m_recording;
+  pj_pool_t *m_pool = nullptr;
+  pjmedia_port m_port = {};
+};
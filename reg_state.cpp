@@ -0,0 +1,241 @@
+#include "reg_state.hpp"
+
+#include <fstream>
+#include <iostream>
+
+#include <pjsua2.hpp>
+#include <yaml-cpp/yaml.h>
+
+namespace {
+std::string print_uri(pjsip_uri_context_e context, const void *uri) {
+  char buf[512];
+  auto len = pjsip_uri_print(context, pjsip_uri_get_uri(uri), buf,
+                             sizeof(buf));
+  return len > 0 ? std::string(buf, len) : std::string();
+}
+
+std::string to_string(const pj_str_t &str) {
+  return std::string(str.ptr, str.slen);
+}
+
+pj_status_t on_tx_request(pjsip_tx_data *tdata) {
+  auto msg = tdata->msg;
+  if (msg->line.req.method.id != PJSIP_REGISTER_METHOD) {
+    return PJ_SUCCESS;
+  }
+  auto from = PJSIP_MSG_FROM_HDR(msg);
+  auto cid = PJSIP_MSG_CID_HDR(msg);
+  auto cseq = PJSIP_MSG_CSEQ_HDR(msg);
+  if (!from || !cid || !cseq) {
+    return PJ_SUCCESS;
+  }
+  auto contact = static_cast<pjsip_contact_hdr *>(
+      pjsip_msg_find_hdr(msg, PJSIP_H_CONTACT, nullptr));
+
+  auto expires_hdr = static_cast<pjsip_expires_hdr *>(
+      pjsip_msg_find_hdr(msg, PJSIP_H_EXPIRES, nullptr));
+  auto &state = RegistrationState::instance();
+  auto aor = print_uri(PJSIP_URI_IN_FROMTO_HDR, from->uri);
+
+  auto call_id = to_string(cid->id);
+  uint32_t cseq_num = cseq->cseq;
+  if (state.on_tx_register(aor, call_id, cseq_num,
+                           contact && contact->uri
+                               ? print_uri(PJSIP_URI_IN_CONTACT_HDR,
+                                           contact->uri)
+                               : std::string())) {
+    // Still unprinted: this module runs before the transport layer's.
+    pj_strdup2(tdata->pool, &cid->id, call_id.c_str());
+    cseq->cseq = cseq_num;
+  }
+  if ((contact && contact->expires == 0) ||
+      (expires_hdr && expires_hdr->ivalue == 0)) {
+    // Unregistering; nothing left to resume.
+    state.on_registered(aor, std::chrono::seconds{0});
+  }
+  return PJ_SUCCESS;
+}
+
+pj_bool_t on_rx_response(pjsip_rx_data *rdata) {
+  auto msg = rdata->msg_info.msg;
+  auto cseq = rdata->msg_info.cseq;
+  if (!cseq || cseq->method.id != PJSIP_REGISTER_METHOD ||
+      msg->line.status.code / 100 != 2 || !rdata->msg_info.from) {
+    return PJ_FALSE;
+  }
+  auto aor = print_uri(PJSIP_URI_IN_FROMTO_HDR, rdata->msg_info.from->uri);
+  auto &state = RegistrationState::instance();
+
+  // The registrar lists every binding for the AOR; ours is the one with the
+  // contact we sent. Failing that, the Expires header covers them all.
+  std::optional<int> expires;
+  auto our_contact = state.contact(aor);
+  for (auto contact = static_cast<pjsip_contact_hdr *>(
+           pjsip_msg_find_hdr(msg, PJSIP_H_CONTACT, nullptr));
+       contact; contact = static_cast<pjsip_contact_hdr *>(pjsip_msg_find_hdr(
+                    msg, PJSIP_H_CONTACT, contact->next))) {
+    if (contact->uri && contact->expires >= 0 &&
+        print_uri(PJSIP_URI_IN_CONTACT_HDR, contact->uri) == our_contact) {
+      expires = contact->expires;
+      break;
+    }
+  }
+  if (!expires) {
+    if (auto expires_hdr = static_cast<const pjsip_expires_hdr *>(
+            pjsip_msg_find_hdr(msg, PJSIP_H_EXPIRES, nullptr))) {
+      expires = expires_hdr->ivalue;
+    }
+  }
+  if (expires) {
+    state.on_registered(aor, std::chrono::seconds{*expires});
+  }
+  // Let the transaction layer have it.
+  return PJ_FALSE;
+}
+
+// Ahead of the transaction layer for incoming responses and, since outgoing
+// messages visit modules in reverse, ahead of the transport layer that
+// prints them.
+pjsip_module registration_module = {
+    nullptr,
+    nullptr,
+    {const_cast<char *>("mod-payphone-reg"), 16},
+    -1,
+    PJSIP_MOD_PRIORITY_TSX_LAYER - 1,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    &on_rx_response,
+    &on_tx_request,
+    nullptr,
+    nullptr,
+};
+} // namespace
+
+RegistrationState &RegistrationState::instance() {
+  static RegistrationState state;
+  return state;
+}
+
+void RegistrationState::load(std::filesystem::path path) {
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_path = std::move(path);
+    if (std::filesystem::exists(m_path)) {
+      try {
+        auto node = YAML::LoadFile(m_path.string());
+        for (auto &&account : node["accounts"]) {
+          SavedRegistration saved;
+          saved.contact = account.second["contact"].as<std::string>("");
+          saved.call_id = account.second["callId"].as<std::string>();
+          saved.cseq = account.second["cseq"].as<uint32_t>();
+          saved.expires = std::chrono::system_clock::from_time_t(
+              account.second["expires"].as<int64_t>());
+          m_saved[account.first.as<std::string>()] = std::move(saved);
+        }
+      } catch (const YAML::Exception &e) {
+        // Only costs a cold start.
+        std::cout << "*** Ignoring " << m_path << ": " << e.what()
+                  << std::endl;
+        m_saved.clear();
+      }
+    }
+  }
+  if (pjsip_endpt_register_module(pjsua_get_pjsip_endpt(),
+                                  &registration_module) != PJ_SUCCESS) {
+    throw std::runtime_error("Could not register registration module");
+  }
+}
+
+std::optional<SavedRegistration>
+RegistrationState::valid(const std::string &aor,
+                         std::chrono::seconds margin) const {
+  // Accounts are configured with a bare URI or a name-addr.
+  auto key = aor;
+  if (auto open = key.find('<'); open != std::string::npos) {
+    key = key.substr(open + 1, key.find('>', open) - open - 1);
+  }
+  std::lock_guard<std::mutex> lk(m_mutex);
+  auto it = m_saved.find(key);
+  if (it == m_saved.end() ||
+      it->second.expires - std::chrono::system_clock::now() < margin) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+std::string RegistrationState::contact(const std::string &aor) const {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  auto it = m_saved.find(aor);
+  return it == m_saved.end() ? std::string() : it->second.contact;
+}
+
+bool RegistrationState::on_tx_register(const std::string &aor,
+                                       std::string &call_id, uint32_t &cseq,
+                                       const std::string &contact) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  auto &saved = m_saved[aor];
+  saved.contact = contact;
+  if (saved.call_id.empty()) {
+    // Nothing saved: carry on with what pjsip chose.
+    saved.call_id = call_id;
+  }
+  if (call_id == saved.call_id) {
+    // Our own, or a retransmission of one we already rewrote.
+    saved.cseq = std::max(saved.cseq, cseq);
+    return false;
+  }
+  call_id = saved.call_id;
+  cseq = ++saved.cseq;
+  return true;
+}
+
+void RegistrationState::on_registered(const std::string &aor,
+                                      std::chrono::seconds expires) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  if (expires.count() == 0) {
+    m_saved.erase(aor);
+  } else {
+    m_saved[aor].expires = std::chrono::system_clock::now() + expires;
+  }
+  if (!m_path.empty()) {
+    save();
+  }
+}
+
+void RegistrationState::save() const {
+  YAML::Emitter out;
+  out << YAML::BeginMap << YAML::Key << "accounts" << YAML::Value
+      << YAML::BeginMap;
+  for (auto &[aor, saved] : m_saved) {
+    if (saved.expires == std::chrono::system_clock::time_point{}) {
+      continue;
+    }
+    out << YAML::Key << aor << YAML::Value << YAML::BeginMap;
+    out << YAML::Key << "contact" << YAML::Value << saved.contact;
+    out << YAML::Key << "callId" << YAML::Value << saved.call_id;
+    out << YAML::Key << "cseq" << YAML::Value << saved.cseq;
+    out << YAML::Key << "expires" << YAML::Value
+        << static_cast<int64_t>(
+               std::chrono::system_clock::to_time_t(saved.expires));
+    out << YAML::EndMap;
+  }
+  out << YAML::EndMap << YAML::EndMap;
+
+  // Written aside and renamed over, so a crash leaves the old file or the
+  // new one.
+  auto tmp = m_path;
+  tmp += ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::trunc);
+    file << out.c_str() << '\n';
+    if (!file) {
+      std::cout << "*** Could not write " << tmp << std::endl;
+      return;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, m_path, ec);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+
+// What a registrar has on record for one account, as of its last successful
+// REGISTER.
+struct SavedRegistration {
+  std::string contact;
+  std::string call_id;
+  uint32_t cseq = 0;
+  std::chrono::system_clock::time_point expires;
+};
+
+// Survives restarts of the process with the registrations intact. Every
+// successful REGISTER is written to a small state file, and a pjsip module
+// rewrites each account's outgoing REGISTERs to carry on the saved Call-ID
+// with an increasing CSeq, so after a restart the registrar sees a refresh
+// of the binding it already has rather than a new one. Accounts are keyed by
+// their address of record, the URI in idUri.
+class RegistrationState {
+public:
+  static RegistrationState &instance();
+
+  // Reads the state file, if there is one, and starts rewriting REGISTERs.
+  // Call once, after the endpoint is initialized and before any account is
+  // created.
+  void load(std::filesystem::path path);
+
+  // The saved registration for aor if it is good for at least margin.
+  std::optional<SavedRegistration>
+  valid(const std::string &aor, std::chrono::seconds margin) const;
+
+  // From the pjsip module. Returns whether the REGISTER's Call-ID and CSeq
+  // were changed.
+  bool on_tx_register(const std::string &aor, std::string &call_id,
+                      uint32_t &cseq, const std::string &contact);
+  // The contact last sent in a REGISTER for aor.
+  std::string contact(const std::string &aor) const;
+  // From the pjsip module, on a 2xx to a REGISTER.
+  void on_registered(const std::string &aor, std::chrono::seconds expires);
+
+private:
+  RegistrationState() = default;
+
+  void save() const;
+
+  std::filesystem::path m_path;
+  mutable std::mutex m_mutex;
+  std::map<std::string, SavedRegistration> m_saved;
+};
@@ -0,0 +1,30 @@
+#include "resource_usage.hpp"
+
+#include <fstream>
+#include <string>
+
+#include <time.h>
+
+namespace {
+size_t read_status_kb(const std::string &key) {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, key.size(), key) == 0 && line.size() > key.size() &&
+        line[key.size()] == ':') {
+      return std::stoul(line.substr(key.size() + 1));
+    }
+  }
+  return 0;
+}
+} // namespace
+
+size_t current_rss_kb() { return read_status_kb("VmRSS"); }
+
+size_t peak_rss_kb() { return read_status_kb("VmHWM"); }
+
+std::chrono::nanoseconds thread_cpu_time() {
+  timespec ts = {};
+  ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
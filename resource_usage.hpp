@@ -0,0 +1,11 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// Resident set size of the whole process, in kilobytes, from /proc.
+size_t current_rss_kb();
+size_t peak_rss_kb();
+
+// CPU time consumed by the calling thread.
+std::chrono::nanoseconds thread_cpu_time();
@@ -0,0 +1,35 @@
+#include "ringer.hpp"
+
+#include <limits>
+#include <stdexcept>
+
+void ToneRinger::set(bool on) {
+  m_tg.stop();
+  if (!on) {
+    return;
+  }
+  pj::ToneDesc tone_desc;
+  tone_desc.freq1 = 440;
+  tone_desc.freq2 = 480;
+  tone_desc.on_msec = std::numeric_limits<short>::max();
+  m_tg.play(pj::ToneDescVector{tone_desc}, true);
+}
+
+GpioRinger::GpioRinger(const std::filesystem::path &gpiochip,
+                       const std::string &line, GpioBackend *backend)
+    : m_chip(gpiochip, backend) {
+  auto idx = m_chip.find_line(line);
+  if (!idx) {
+    throw std::runtime_error("Could not find ringer line in gpiochip");
+  }
+
+  GpioChip::LineConfig line_config;
+  line_config.flags = GpioLineFlags{GpioLineFlags::Output};
+  line_config.attrs = {{{0}, GpioLineValues{}}};
+  m_line = m_chip.make_line_event_source({*idx}, "PhoneRinger",
+                                         std::move(line_config));
+}
+
+void GpioRinger::set(bool on) {
+  m_line.set_values(on ? GpioLineValues{0} : GpioLineValues{}, {0});
+}
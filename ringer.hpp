@@ -0,0 +1,41 @@
+#pragma once
+
+#include "gpio.hpp"
+
+#include <filesystem>
+#include <string>
+
+#include <pjsua2.hpp>
+
+// Something that rings the phone. The line state machine drives the ring
+// cadence, so a ringer only needs to be switched on and off.
+class Ringer {
+public:
+  virtual ~Ringer() = default;
+
+  virtual void set(bool on) = 0;
+};
+
+// Rings through the handset's own speaker with the line's tone generator.
+class ToneRinger : public Ringer {
+public:
+  explicit ToneRinger(pj::ToneGenerator &tg) : m_tg(tg) {}
+
+  void set(bool on) override;
+
+private:
+  pj::ToneGenerator &m_tg;
+};
+
+// Drives a bell or buzzer relay from a GPIO output line.
+class GpioRinger : public Ringer {
+public:
+  GpioRinger(const std::filesystem::path &gpiochip, const std::string &line,
+             GpioBackend *backend = GpioBackend::system());
+
+  void set(bool on) override;
+
+private:
+  GpioChip m_chip;
+  GpioChip::LineEventSource m_line;
+};
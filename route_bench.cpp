@@ -0,0 +1,92 @@
+#include "routing.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Builds a routing table of a million random E.164 prefixes spread over a
+// hundred trunks, checks lookups against a brute force longest match, and
+// times them.
+//
+//   route_bench [routes]
+int main(int argc, char **argv) {
+  size_t num_routes = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+  std::mt19937 rng(1);
+  auto digits = [&](size_t count) {
+    std::string out;
+    for (size_t idx = 0; idx < count; ++idx) {
+      out.push_back('0' + rng() % 10);
+    }
+    return out;
+  };
+
+  std::vector<RouteEntry> entries;
+  entries.push_back({"911", {"", "emergency.example.com", ""}});
+  entries.push_back({"+1800", {"tollfree", "", "tcp"}});
+  std::map<std::string, Route> reference;
+  for (auto &entry : entries) {
+    reference[entry.prefix] = entry.route;
+  }
+  while (reference.size() < num_routes) {
+    auto trunk = rng() % 100;
+    entries.push_back({"+" + digits(2 + rng() % 8),
+                       {"", "trunk" + std::to_string(trunk) + ".example.com",
+                        trunk % 3 == 0 ? "tls" : "udp"}});
+    reference[entries.back().prefix] = entries.back().route;
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  RouteTable table(entries);
+  auto built = std::chrono::steady_clock::now();
+
+  std::vector<std::string> numbers;
+  for (int idx = 0; idx < 1000000; ++idx) {
+    numbers.push_back("+" + digits(11));
+  }
+  numbers.push_back("911");
+  numbers.push_back("+18005551212");
+
+  size_t mismatches = 0;
+  for (size_t idx = 0; idx < numbers.size(); idx += 97) {
+    auto &number = numbers[idx];
+    const Route *expected = nullptr;
+    for (size_t len = number.size(); len > 0 && !expected; --len) {
+      auto it = reference.find(number.substr(0, len));
+      if (it != reference.end()) {
+        expected = &it->second;
+      }
+    }
+    auto found = table.lookup(number);
+    if ((expected == nullptr) != (found == nullptr) ||
+        (expected && !(*expected == *found))) {
+      ++mismatches;
+    }
+  }
+
+  size_t hits = 0;
+  auto lookup_begin = std::chrono::steady_clock::now();
+  for (auto &number : numbers) {
+    hits += table.lookup(number) != nullptr;
+  }
+  auto lookup_end = std::chrono::steady_clock::now();
+
+  std::cout << table.size() << " routes, "
+            << table.memory_usage() / (1024 * 1024) << "MB\n"
+            << "build "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(built -
+                                                                     begin)
+                   .count()
+            << "ms\n"
+            << "lookup "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   lookup_end - lookup_begin)
+                       .count() /
+                   numbers.size()
+            << "ns, " << hits << "/" << numbers.size() << " routed\n"
+            << "mismatches " << mismatches << std::endl;
+  return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+#include "routing.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <phonenumbers/phonenumber.pb.h>
+#include <phonenumbers/phonenumberutil.h>
+
+namespace {
+int symbol(char ch) noexcept {
+  switch (ch) {
+  case '*':
+    return 10;
+  case '#':
+    return 11;
+  case '+':
+    return 12;
+  default:
+    return ch >= '0' && ch <= '9' ? ch - '0' : -1;
+  }
+}
+} // namespace
+
+std::vector<RouteEntry> read_route_csv(const std::filesystem::path &path) {
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("Could not open " + path.string());
+  }
+  std::vector<RouteEntry> entries;
+  std::string line;
+  for (size_t line_no = 1; std::getline(in, line); ++line_no) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream row(line);
+    RouteEntry entry;
+    std::getline(row, entry.prefix, ',');
+    std::getline(row, entry.route.account, ',');
+    std::getline(row, entry.route.domain, ',');
+    std::getline(row, entry.route.transport);
+    if (!entry.route.transport.empty() &&
+        entry.route.transport.back() == '\r') {
+      entry.route.transport.pop_back();
+    }
+    if (entry.prefix.empty()) {
+      throw std::runtime_error(path.string() + ":" + std::to_string(line_no) +
+                               ": missing prefix");
+    }
+    entries.push_back(std::move(entry));
+  }
+  return entries;
+}
+
+RouteTable::RouteTable(std::vector<RouteEntry> entries) {
+  std::vector<std::pair<std::string, uint32_t>> keys;
+  keys.reserve(entries.size());
+  std::unordered_map<std::string, uint32_t> route_ids;
+  for (auto &entry : entries) {
+    std::string key;
+    for (char ch : entry.prefix) {
+      auto sym = symbol(ch);
+      if (sym < 0) {
+        throw std::invalid_argument("Bad route prefix " + entry.prefix);
+      }
+      key.push_back(sym);
+    }
+    auto &route = entry.route;
+    auto [it, inserted] = route_ids.try_emplace(
+        route.account + '\0' + route.domain + '\0' + route.transport,
+        m_routes.size() + 1);
+    if (inserted) {
+      m_routes.push_back(std::move(route));
+    }
+    keys.emplace_back(std::move(key), it->second);
+  }
+  std::stable_sort(keys.begin(), keys.end(), [](const auto &a, const auto &b) {
+    return a.first < b.first;
+  });
+
+  // Breadth first, so every node's children can be allocated together.
+  struct Pending {
+    uint32_t node;
+    size_t lo, hi, depth;
+  };
+  std::deque<Pending> queue;
+  m_nodes.emplace_back();
+  queue.push_back({0, 0, keys.size(), 0});
+  while (!queue.empty()) {
+    auto [node, lo, hi, depth] = queue.front();
+    queue.pop_front();
+    // The prefix that ends here sorts first; the last duplicate wins.
+    for (; lo < hi && keys[lo].first.size() == depth; ++lo) {
+      m_size += m_nodes[node].route == 0;
+      m_nodes[node].route = keys[lo].second;
+    }
+    m_nodes[node].first_child = m_nodes.size();
+    while (lo < hi) {
+      auto sym = keys[lo].first[depth];
+      auto end = lo;
+      while (end < hi && keys[end].first[depth] == sym) {
+        ++end;
+      }
+      m_nodes[node].child_mask |= 1 << sym;
+      queue.push_back({static_cast<uint32_t>(m_nodes.size()), lo, end,
+                       depth + 1});
+      m_nodes.emplace_back();
+      lo = end;
+    }
+  }
+  m_nodes.shrink_to_fit();
+}
+
+const Route *RouteTable::lookup(std::string_view number) const noexcept {
+  auto node = &m_nodes[0];
+  auto best = node->route;
+  for (char ch : number) {
+    auto sym = symbol(ch);
+    if (sym < 0 || !(node->child_mask & (1 << sym))) {
+      break;
+    }
+    node = &m_nodes[node->first_child +
+                    __builtin_popcount(node->child_mask & ((1u << sym) - 1))];
+    if (node->route != 0) {
+      best = node->route;
+    }
+  }
+  return best != 0 ? &m_routes[best - 1] : nullptr;
+}
+
+size_t RouteTable::memory_usage() const noexcept {
+  size_t total = m_nodes.capacity() * sizeof(Node);
+  for (auto &route : m_routes) {
+    total += sizeof(Route) + route.account.capacity() +
+             route.domain.capacity() + route.transport.capacity();
+  }
+  return total;
+}
+
+NumberNormalizer::NumberNormalizer(std::string region)
+    : m_region(std::move(region)),
+      m_util(*i18n::phonenumbers::PhoneNumberUtil::GetInstance()) {}
+
+std::string NumberNormalizer::normalize(const std::string &dialed) const {
+  using i18n::phonenumbers::PhoneNumberUtil;
+  i18n::phonenumbers::PhoneNumber number;
+  if (m_util.Parse(dialed, m_region, &number) !=
+          PhoneNumberUtil::NO_PARSING_ERROR ||
+      !m_util.IsPossibleNumber(number)) {
+    return dialed;
+  }
+  std::string e164;
+  m_util.Format(number, PhoneNumberUtil::E164, &e164);
+  return e164;
+}
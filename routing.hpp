@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace i18n::phonenumbers {
+class PhoneNumberUtil;
+}
+
+// Where to send calls to numbers with a given prefix. Empty fields fall back
+// to the line's own account and registrar.
+struct Route {
+  std::string account;
+  std::string domain;
+  // "udp", "tcp" or "tls".
+  std::string transport;
+
+  bool operator==(const Route &other) const {
+    return account == other.account && domain == other.domain &&
+           transport == other.transport;
+  }
+};
+
+struct RouteEntry {
+  // Digits, '*', '#' and a leading '+'.
+  std::string prefix;
+  Route route;
+};
+
+// Reads prefix,account,domain,transport rows. Blank lines and lines starting
+// with '#' are skipped.
+std::vector<RouteEntry> read_route_csv(const std::filesystem::path &path);
+
+// Longest prefix match over dialed numbers. The prefixes are kept in a trie
+// whose nodes sit in one array with each node's children next to each other,
+// so a node is 12 bytes and a lookup is one step per digit. Routes are
+// deduplicated; most tables send millions of prefixes to a handful of trunks.
+class RouteTable {
+public:
+  // Later entries for the same prefix replace earlier ones.
+  explicit RouteTable(std::vector<RouteEntry> entries);
+
+  // The route of the longest prefix of number in the table, or nullptr.
+  const Route *lookup(std::string_view number) const noexcept;
+
+  size_t size() const noexcept { return m_size; }
+  size_t memory_usage() const noexcept;
+
+private:
+  struct Node {
+    uint32_t first_child = 0;
+    // 1-based index into m_routes, 0 if no prefix ends here.
+    uint32_t route = 0;
+    // Which of the 13 symbols have a child, in symbol order.
+    uint16_t child_mask = 0;
+  };
+
+  std::vector<Node> m_nodes;
+  std::vector<Route> m_routes;
+  size_t m_size = 0;
+};
+
+// Turns dialed digits into E.164 for the routing table. Numbers that can't be
+// international numbers, like 911 or star codes, are left as dialed.
+class NumberNormalizer {
+public:
+  explicit NumberNormalizer(std::string region);
+
+  std::string normalize(const std::string &dialed) const;
+
+private:
+  std::string m_region;
+  const i18n::phonenumbers::PhoneNumberUtil &m_util;
+};
@@ -0,0 +1,63 @@
+#include "sidetone.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+Sidetone::Sidetone(unsigned clock_rate, unsigned samples_per_frame)
+    : m_clock_rate(clock_rate),
+      m_max_backlog(std::min<size_t>(2 * samples_per_frame, ring_size / 2)),
+      m_ring(new int16_t[ring_size]()) {}
+
+void Sidetone::set_level(float level_db) noexcept {
+  auto gain = std::pow(10.0f, level_db / 20);
+  m_gain.store(std::isfinite(level_db) ? std::lround(gain * 32768) : 0,
+               std::memory_order_relaxed);
+}
+
+void Sidetone::capture(const int16_t *samples, size_t count) noexcept {
+  if (m_gain.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  auto written = m_written.load(std::memory_order_relaxed);
+  count = std::min(count, ring_size);
+  for (size_t idx = 0; idx < count; ++idx) {
+    m_ring[(written + idx) % ring_size] = samples[idx];
+  }
+  m_written_at.store(std::chrono::steady_clock::now().time_since_epoch() /
+                         std::chrono::nanoseconds{1},
+                     std::memory_order_relaxed);
+  m_written.store(written + count, std::memory_order_release);
+}
+
+void Sidetone::mix(int16_t *samples, size_t count) noexcept {
+  auto gain = m_gain.load(std::memory_order_relaxed);
+  if (gain == 0) {
+    return;
+  }
+  auto written = m_written.load(std::memory_order_acquire);
+  if (written - m_read > m_max_backlog) {
+    m_read = written - std::min(count, m_max_backlog);
+  }
+  auto available = std::min<size_t>(written - m_read, count);
+  if (available == 0) {
+    return;
+  }
+
+  // Q15 multiply and saturate, written so the compiler can vectorize it.
+  for (size_t idx = 0; idx < available; ++idx) {
+    int32_t mixed =
+        samples[idx] + ((m_ring[(m_read + idx) % ring_size] * gain) >> 15);
+    samples[idx] = static_cast<int16_t>(std::clamp(mixed, -32768, 32767));
+  }
+  m_read += available;
+
+  // How long ago the newest sample we just played was captured.
+  auto written_at = std::chrono::nanoseconds{
+      m_written_at.load(std::memory_order_relaxed)};
+  auto behind = std::chrono::nanoseconds{
+      (written - m_read) * std::nano::den / m_clock_rate};
+  Metrics::instance().sidetone_latency.record(
+      std::chrono::steady_clock::now().time_since_epoch() - written_at +
+      behind);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Mixes an attenuated copy of the microphone into the earpiece inside the
+// sound device's own callbacks, so the talker hears themselves without the
+// frame or more of delay a trip through the conference bridge would add.
+// Captured samples go into a ring that the playback callback drains; if the
+// playback side falls behind it skips ahead rather than letting the delay
+// build up. The capture and playback callbacks may run on different threads.
+class Sidetone {
+public:
+  Sidetone(unsigned clock_rate, unsigned samples_per_frame);
+
+  // Level relative to the microphone in dB. -infinity turns it off.
+  void set_level(float level_db) noexcept;
+
+  // Capture thread.
+  void capture(const int16_t *samples, size_t count) noexcept;
+  // Playback thread. Adds the queued microphone audio into samples.
+  void mix(int16_t *samples, size_t count) noexcept;
+
+private:
+  constexpr static size_t ring_size = 4096;
+
+  unsigned m_clock_rate;
+  // The most the playback side is allowed to lag the microphone by.
+  size_t m_max_backlog;
+  std::unique_ptr<int16_t[]> m_ring;
+  // Q15 gain.
+  std::atomic<int32_t> m_gain{0};
+  std::atomic<uint64_t> m_written{0};
+  std::atomic<int64_t> m_written_at{0};
+  uint64_t m_read = 0;
+};
@@ -0,0 +1,97 @@
+#include "audio_device.hpp"
+#include "metrics.hpp"
+#include "sidetone.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+uint64_t percentile(const Histogram &hist, double fraction) {
+  uint64_t target = hist.count() * fraction;
+  uint64_t seen = 0;
+  for (size_t idx = 0; idx < Histogram::NumBuckets; ++idx) {
+    seen += hist.bucket_count(idx);
+    if (seen > target) {
+      return Histogram::bucket_upper_bound(idx);
+    }
+  }
+  return 0;
+}
+
+// With nothing coming from the bridge the earpiece frame is NONE; the
+// talker must still be heard in it.
+bool sidetone_with_silent_bridge(unsigned clock_rate, unsigned frame) {
+  Sidetone sidetone(clock_rate, frame);
+  sidetone.set_level(-15);
+  LoudGain loud;
+  std::vector<int16_t> mic(frame, 10000);
+  sidetone.capture(mic.data(), mic.size());
+
+  std::vector<int16_t> pcm(frame, 12345);
+  pjmedia_frame silent = {};
+  silent.type = PJMEDIA_FRAME_TYPE_NONE;
+  silent.buf = pcm.data();
+  AudioDevice::process_playback(&silent, pcm.size() * sizeof(int16_t), loud,
+                                sidetone);
+  return silent.type == PJMEDIA_FRAME_TYPE_AUDIO &&
+         silent.size == pcm.size() * sizeof(int16_t) &&
+         std::all_of(pcm.begin(), pcm.end(), [](int16_t sample) {
+           return sample > 0 && sample < 5000;
+         });
+}
+} // namespace
+
+// Loopback: a capture thread and a playback thread run the sidetone the way
+// a full duplex sound device's callbacks would, each on its own 20ms clock
+// with the playback clock half a frame behind. Reports the capture to
+// playback latency the sidetone adds and what each callback costs.
+int main() {
+  constexpr unsigned clock_rate = 16000;
+  constexpr unsigned frame = clock_rate / 50;
+  constexpr auto period = std::chrono::milliseconds{20};
+  constexpr int frames = 250;
+
+  if (!sidetone_with_silent_bridge(clock_rate, frame)) {
+    std::cerr << "no sidetone with a silent bridge" << std::endl;
+    return 1;
+  }
+
+  Sidetone sidetone(clock_rate, frame);
+  sidetone.set_level(-15);
+
+  std::chrono::nanoseconds capture_cost{0}, mix_cost{0};
+  auto start = std::chrono::steady_clock::now() + period;
+  std::thread capture([&] {
+    std::vector<int16_t> pcm(frame, 1000);
+    for (int idx = 0; idx < frames; ++idx) {
+      std::this_thread::sleep_until(start + idx * period);
+      auto begin = std::chrono::steady_clock::now();
+      sidetone.capture(pcm.data(), pcm.size());
+      capture_cost += std::chrono::steady_clock::now() - begin;
+    }
+  });
+  std::thread playback([&] {
+    std::vector<int16_t> pcm(frame);
+    for (int idx = 0; idx < frames; ++idx) {
+      std::this_thread::sleep_until(start + idx * period + period / 2);
+      std::fill(pcm.begin(), pcm.end(), 0);
+      auto begin = std::chrono::steady_clock::now();
+      sidetone.mix(pcm.data(), pcm.size());
+      mix_cost += std::chrono::steady_clock::now() - begin;
+    }
+  });
+  capture.join();
+  playback.join();
+
+  auto &latency = Metrics::instance().sidetone_latency;
+  std::cout << "frames=" << latency.count()
+            << " latency_p50_us=" << percentile(latency, 0.5)
+            << " latency_p99_us=" << percentile(latency, 0.99)
+            << " frame_us=" << period / std::chrono::microseconds{1}
+            << " capture_ns_per_frame=" << capture_cost.count() / frames
+            << " mix_ns_per_frame=" << mix_cost.count() / frames << std::endl;
+  return 0;
+}
@@ -0,0 +1,182 @@
+#include "sip.hpp"
+
+#include "line.hpp"
+#include "metrics.hpp"
+#include "recorder_port.hpp"
+#include "resource_usage.hpp"
+#include "trace.hpp"
+
+#include <iostream>
+
+void Endpoint::onTransportState(const pj::OnTransportStateParam &prm) {
+  if (prm.state == PJSIP_TP_STATE_DISCONNECTED && prm.type != "UDP") {
+    std::cout << "*** " << prm.type << " connection lost" << std::endl;
+    if (m_on_disconnected) {
+      m_on_disconnected();
+    }
+  }
+}
+
+namespace {
+pj_caching_pool &caching_pool() {
+  // pjsua's factory is the first member of its caching pool.
+  return *reinterpret_cast<pj_caching_pool *>(pjsua_get_pool_factory());
+}
+} // namespace
+
+size_t sip_pool_used_bytes() {
+  auto &cp = caching_pool();
+  pj_lock_acquire(cp.lock);
+  size_t used = cp.used_size;
+  pj_lock_release(cp.lock);
+  return used;
+}
+
+void set_pool_cache_kb(size_t kb) {
+  auto &cp = caching_pool();
+  pj_lock_acquire(cp.lock);
+  cp.max_capacity = kb * 1024;
+  pj_lock_release(cp.lock);
+}
+
+Call::Call(pj::Account &account, Line *line, int call_id)
+    : pj::Call(account, call_id), m_pool_at_start(sip_pool_used_bytes()),
+      m_line(line) {}
+
+Call::~Call() = default;
+
+void Call::dial(const std::string &uri) {
+  Trace::Scope trace_scope(Trace::Span::MakeCall);
+  m_dial_time = std::chrono::steady_clock::now();
+  makeCall(uri, {});
+}
+
+void Call::pick_up(const pj::CallOpParam &prm) {
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_pick_up_time = std::chrono::steady_clock::now();
+  }
+  answer(prm);
+}
+
+void Call::onCallState(pj::OnCallStateParam &) {
+  auto ci = getInfo();
+  Trace::Scope trace_scope(Trace::Span::CallState, ci.state);
+  if (ci.state != PJSIP_INV_STATE_DISCONNECTED &&
+      ci.state != PJSIP_INV_STATE_EARLY &&
+      ci.state != PJSIP_INV_STATE_CONFIRMED) {
+    return;
+  }
+  if (ci.state == PJSIP_INV_STATE_CONFIRMED && m_dial_time) {
+    Metrics::instance().call_setup.record(std::chrono::steady_clock::now() -
+                                          *m_dial_time);
+  } else if (ci.state == PJSIP_INV_STATE_DISCONNECTED) {
+    Metrics::instance().count_call(ci.lastStatusCode);
+  }
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_last_state = ci.state;
+  m_last_status_code = ci.lastStatusCode;
+  m_line->notify();
+}
+
+void Call::onCallMediaState(pj::OnCallMediaStateParam &) {
+  Trace::Scope trace_scope(Trace::Span::CallMediaState);
+  pj::CallInfo ci = getInfo();
+
+  for (unsigned i = 0; i < ci.media.size(); i++) {
+    if (ci.media[i].type == PJMEDIA_TYPE_AUDIO && getMedia(i)) {
+      pj::AudioMedia *aud_med = (pj::AudioMedia *)getMedia(i);
+
+      // Connect the call audio media to this line's sound device
+      auto &device = m_line->audio_device();
+      aud_med->startTransmit(device.playback());
+      device.capture().startTransmit(*aud_med);
+
+      if (!m_recorder) {
+        m_recorder = m_line->start_recording(ci.remoteUri);
+      }
+      if (m_recorder) {
+        aud_med->startTransmit(*m_recorder);
+        device.capture().startTransmit(*m_recorder);
+      }
+
+      std::lock_guard<std::mutex> lk(m_mutex);
+      if (!m_memory_reported) {
+        // Media is the bulk of it: streams, jitter buffer, codec state.
+        std::cout << "*** Call memory: pools +"
+                  << (static_cast<ptrdiff_t>(sip_pool_used_bytes()) -
+                      static_cast<ptrdiff_t>(m_pool_at_start)) /
+                         1024
+                  << "kB, RSS " << current_rss_kb() << "kB" << std::endl;
+        m_memory_reported = true;
+      }
+      if (m_pick_up_time) {
+        Metrics::instance().answer.record(std::chrono::steady_clock::now() -
+                                          *m_pick_up_time);
+        m_pick_up_time.reset();
+      }
+      if (ci.role == PJSIP_ROLE_UAC && ci.state < PJSIP_INV_STATE_CONFIRMED &&
+          ci.media[i].status == PJSUA_CALL_MEDIA_ACTIVE && m_dial_time) {
+        std::cout << "*** Early media after "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - *m_dial_time)
+                         .count()
+                  << "ms" << std::endl;
+        m_line->early_media();
+      }
+    }
+  }
+}
+
+void Account::onRegStarted(pj::OnRegStartedParam &) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_reg_started = std::chrono::steady_clock::now();
+}
+
+void Account::onRegState(pj::OnRegStateParam &prm) {
+  Trace::Scope trace_scope(Trace::Span::RegState, prm.code);
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_reg_started) {
+      Metrics::instance().registration.record(
+          std::chrono::steady_clock::now() - *m_reg_started);
+      m_reg_started.reset();
+    }
+  }
+  pj::AccountInfo ai = getInfo();
+  std::cout << "*** " << m_line->name() << " " << m_name
+            << (ai.regIsActive ? " Register: code=" : " Unregister: code=")
+            << prm.code << std::endl;
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_registered = ai.regIsActive;
+    m_warm_until.reset();
+  }
+  m_line->registration_changed();
+}
+
+bool Account::registered() {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return m_registered ||
+         (m_warm_until && std::chrono::system_clock::now() < *m_warm_until);
+}
+
+bool Account::healthy() {
+  if (!registered()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return !m_last_failure ||
+         std::chrono::steady_clock::now() - *m_last_failure >=
+             failure_hold_off;
+}
+
+void Account::call_failed() {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_last_failure = std::chrono::steady_clock::now();
+}
+
+void Account::onIncomingCall(pj::OnIncomingCallParam &iprm) {
+  Trace::Scope trace_scope(Trace::Span::IncomingCall, iprm.callId);
+  m_line->offer_call(std::make_unique<Call>(*this, m_line, iprm.callId));
+}
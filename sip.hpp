@@ -0,0 +1,143 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include <pjsua2.hpp>
+
+class Line;
+class RecorderPort;
+
+// Memory handed out by pjsua's pool factory, all calls and accounts
+// included.
+size_t sip_pool_used_bytes();
+// Caps how much released pool memory pjsua keeps around for reuse. The only
+// pool knob there is at runtime: pjsua creates its pools with the sizes
+// compiled into pjproject.
+void set_pool_cache_kb(size_t kb);
+
+class Endpoint : public pj::Endpoint {
+public:
+  virtual pj_status_t onCredAuth(pj::OnCredAuthParam &prm) {
+    PJ_UNUSED_ARG(prm);
+    std::cout << "*** Callback onCredAuth called ***" << std::endl;
+    /* Return PJ_ENOTSUP to use
+     * pjsip_auth_create_aka_response()/<b>libmilenage</b> (default),
+     * if PJSIP_HAS_DIGEST_AKA_AUTH is defined.
+     */
+    return PJ_ENOTSUP;
+  }
+
+  // Called from the pjsip thread whenever a TCP or TLS connection drops.
+  void set_on_disconnected(std::function<void()> on_disconnected) {
+    m_on_disconnected = std::move(on_disconnected);
+  }
+
+  void onTransportState(const pj::OnTransportStateParam &prm) override;
+
+private:
+  std::function<void()> m_on_disconnected;
+};
+
+class Call : public pj::Call {
+public:
+  Call(pj::Account &account, Line *line, int call_id = PJSUA_INVALID_ID);
+  ~Call();
+
+  struct State {
+    pjsip_inv_state state;
+    pjsip_status_code status_code;
+  };
+
+  State get_state() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return {m_last_state, m_last_status_code};
+  }
+
+  void dial(const std::string &uri);
+
+  // Answers an incoming call, timing how long it takes until media flows.
+  void pick_up(const pj::CallOpParam &prm);
+
+protected:
+  // Notification when call's state has changed.
+  void onCallState(pj::OnCallStateParam &prm) override;
+
+  // Notification when call's media state has changed.
+  void onCallMediaState(pj::OnCallMediaStateParam &) override;
+
+private:
+  std::mutex m_mutex;
+  pjsip_inv_state m_last_state = PJSIP_INV_STATE_NULL;
+  pjsip_status_code m_last_status_code = PJSIP_SC_NULL;
+  std::optional<std::chrono::steady_clock::time_point> m_dial_time;
+  std::optional<std::chrono::steady_clock::time_point> m_pick_up_time;
+  // Pool usage when the call was created, for its memory report.
+  size_t m_pool_at_start;
+  bool m_memory_reported = false;
+  Line *m_line;
+  std::unique_ptr<RecorderPort> m_recorder;
+};
+
+// One SIP account of a line. Tracks whether it is registered and whether
+// calls through it have been failing, so the line can pick a working one.
+class Account : public pj::Account {
+public:
+  Account(Line *line, std::string name, std::string domain,
+          std::string transport)
+      : m_line(line), m_name(std::move(name)), m_domain(std::move(domain)),
+        m_transport(std::move(transport)) {}
+
+  const std::string &name() const noexcept { return m_name; }
+  // Host part of the account's URI, where calls go unless routed elsewhere.
+  const std::string &domain() const noexcept { return m_domain; }
+  // Transport parameter for URIs called through this account, if any.
+  const std::string &transport() const noexcept { return m_transport; }
+
+  // Registered, or, until pjsua first reports, holding a registration
+  // saved before a restart.
+  bool registered();
+
+  // Treat the account as registered until expires, from a registration
+  // saved before a restart, while pjsua refreshes it in the background.
+  void assume_registered_until(std::chrono::system_clock::time_point expires) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_warm_until = expires;
+  }
+
+  // Registered, and no call has failed with 408 or 503 recently.
+  bool healthy();
+
+  // A call through this account failed in a way another account might not.
+  void call_failed();
+
+  std::unique_ptr<Call> make_call() {
+    return std::make_unique<Call>(*this, m_line);
+  }
+
+protected:
+  void onRegStarted(pj::OnRegStartedParam &) override;
+
+  virtual void onRegState(pj::OnRegStateParam &prm);
+
+  virtual void onIncomingCall(pj::OnIncomingCallParam &iprm);
+
+private:
+  // How long an account that failed a call is passed over.
+  constexpr static std::chrono::seconds failure_hold_off{30};
+
+  Line *m_line;
+  std::string m_name;
+  std::string m_domain;
+  std::string m_transport;
+  std::mutex m_mutex;
+  bool m_registered = false;
+  std::optional<std::chrono::system_clock::time_point> m_warm_until;
+  std::optional<std::chrono::steady_clock::time_point> m_reg_started;
+  std::optional<std::chrono::steady_clock::time_point> m_last_failure;
+};
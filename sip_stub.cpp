@@ -0,0 +1,307 @@
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <random>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Stand-in registrar and call peer on loopback UDP and TCP, for trying out
+// the payphone's account and transport handling without a real PBX. Answers
+// REGISTER, and answers every INVITE with one fixed final response, or with
+// 183 and early media until the caller cancels.
+//
+//   sip_stub [--port 5070] [--register 200|403|drop]
+//            [--invite 200|183|408|503|drop] [--loss FRACTION]
+//
+// Point an account's registrarUri at sip:127.0.0.1:<port>. Run several on
+// different ports to stand in for primary and secondary registrars. --loss
+// drops that fraction of UDP datagrams each way; for TCP use netem on lo.
+namespace {
+struct Request {
+  std::string method;
+  std::vector<std::string> vias;
+  std::string from, to, call_id, cseq, contact;
+};
+
+bool header_is(const std::string &line, const char *name, const char *compact) {
+  auto colon = line.find(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+  auto field = line.substr(0, colon);
+  while (!field.empty() && field.back() == ' ') {
+    field.pop_back();
+  }
+  return strcasecmp(field.c_str(), name) == 0 ||
+         strcasecmp(field.c_str(), compact) == 0;
+}
+
+std::string value(const std::string &line) {
+  auto start = line.find_first_not_of(' ', line.find(':') + 1);
+  return start == std::string::npos ? "" : line.substr(start);
+}
+
+Request parse(const std::string &msg) {
+  Request req;
+  std::istringstream in(msg);
+  std::string line;
+  std::getline(in, line);
+  req.method = line.substr(0, line.find(' '));
+  while (std::getline(in, line) && line != "\r" && !line.empty()) {
+    if (line.back() == '\r') {
+      line.pop_back();
+    }
+    if (header_is(line, "Via", "v")) {
+      req.vias.push_back(value(line));
+    } else if (header_is(line, "From", "f")) {
+      req.from = value(line);
+    } else if (header_is(line, "To", "t")) {
+      req.to = value(line);
+    } else if (header_is(line, "Call-ID", "i")) {
+      req.call_id = value(line);
+    } else if (header_is(line, "CSeq", "")) {
+      req.cseq = value(line);
+    } else if (header_is(line, "Contact", "m")) {
+      req.contact = value(line);
+    }
+  }
+  return req;
+}
+
+std::string response(const Request &req, int code, const char *reason,
+                     const std::string &extra = "",
+                     const std::string &body = "") {
+  std::ostringstream out;
+  out << "SIP/2.0 " << code << " " << reason << "\r\n";
+  for (auto &via : req.vias) {
+    out << "Via: " << via << "\r\n";
+  }
+  out << "From: " << req.from << "\r\n"
+      << "To: " << req.to
+      << (req.to.find(";tag=") == std::string::npos && code > 100
+              ? ";tag=stub"
+              : "")
+      << "\r\n"
+      << "Call-ID: " << req.call_id << "\r\n"
+      << "CSeq: " << req.cseq << "\r\n"
+      << extra << "Content-Length: " << body.size() << "\r\n\r\n"
+      << body;
+  return out.str();
+}
+
+const char *reason(int code) {
+  switch (code) {
+  case 200:
+    return "OK";
+  case 403:
+    return "Forbidden";
+  case 408:
+    return "Request Timeout";
+  case 183:
+    return "Session Progress";
+  case 486:
+    return "Busy Here";
+  case 487:
+    return "Request Terminated";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return "Whatever";
+  }
+}
+
+struct Options {
+  int port = 5070;
+  std::string register_reply = "200";
+  std::string invite_reply = "503";
+  double loss = 0;
+};
+
+void handle(const Options &options, const std::string &msg,
+            const std::function<void(const std::string &)> &send) {
+  auto req = parse(msg);
+  std::cout << req.method << " " << req.call_id << std::endl;
+
+  if (req.method == "REGISTER") {
+    if (options.register_reply == "drop") {
+      return;
+    }
+    int code = std::atoi(options.register_reply.c_str());
+    send(response(req, code, reason(code),
+                  code == 200 ? "Contact: " + req.contact + "\r\n" : ""));
+  } else if (req.method == "INVITE") {
+    if (options.invite_reply == "drop") {
+      return;
+    }
+    int code = std::atoi(options.invite_reply.c_str());
+    if (code != 200 && code != 183) {
+      send(response(req, 100, "Trying"));
+      send(response(req, code, reason(code)));
+      return;
+    }
+    std::string sdp = "v=0\r\n"
+                      "o=- 1 1 IN IP4 127.0.0.1\r\n"
+                      "s=-\r\n"
+                      "c=IN IP4 127.0.0.1\r\n"
+                      "t=0 0\r\n"
+                      "m=audio 4000 RTP/AVP 0\r\n"
+                      "a=rtpmap:0 PCMU/8000\r\n";
+    // Straight to 200 with no provisional response, so a lost 200 over UDP
+    // is recovered by the caller retransmitting the INVITE. 183 stays in
+    // early media until the caller cancels.
+    send(response(req, code, reason(code),
+                  "Contact: <sip:stub@127.0.0.1:" +
+                      std::to_string(options.port) +
+                      ">\r\nContent-Type: application/sdp\r\n",
+                  sdp));
+  } else if (req.method == "CANCEL") {
+    send(response(req, 200, "OK"));
+    auto invite = req;
+    invite.cseq = req.cseq.substr(0, req.cseq.find(' ')) + " INVITE";
+    send(response(invite, 487, reason(487)));
+  } else if (req.method != "ACK") {
+    send(response(req, 200, "OK"));
+  }
+}
+
+// Takes one whole message off the front of a TCP stream, if there is one.
+// Answers CRLF keepalives along the way.
+bool next_message(std::string &stream, std::string &msg, int fd) {
+  while (stream.compare(0, 4, "\r\n\r\n") == 0) {
+    stream.erase(0, 4);
+    ::send(fd, "\r\n", 2, MSG_NOSIGNAL);
+  }
+  while (stream.compare(0, 2, "\r\n") == 0) {
+    stream.erase(0, 2);
+  }
+  auto header_end = stream.find("\r\n\r\n");
+  if (header_end == std::string::npos) {
+    return false;
+  }
+  size_t body = 0;
+  std::istringstream in(stream.substr(0, header_end));
+  std::string line;
+  while (std::getline(in, line)) {
+    if (header_is(line, "Content-Length", "l")) {
+      body = std::stoul(value(line));
+    }
+  }
+  auto total = header_end + 4 + body;
+  if (stream.size() < total) {
+    return false;
+  }
+  msg = stream.substr(0, total);
+  stream.erase(0, total);
+  return true;
+}
+
+int bind_socket(int type, int port) {
+  int fd = ::socket(AF_INET, type, 0);
+  int one = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd == -1 ||
+      ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1 ||
+      (type == SOCK_STREAM && ::listen(fd, 16) == -1)) {
+    throw std::system_error(errno, std::system_category(), "bind");
+  }
+  return fd;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int idx = 1; idx + 1 < argc; idx += 2) {
+    std::string arg = argv[idx];
+    if (arg == "--port") {
+      options.port = std::atoi(argv[idx + 1]);
+    } else if (arg == "--register") {
+      options.register_reply = argv[idx + 1];
+    } else if (arg == "--invite") {
+      options.invite_reply = argv[idx + 1];
+    } else if (arg == "--loss") {
+      options.loss = std::atof(argv[idx + 1]);
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      return 2;
+    }
+  }
+
+  int udp = bind_socket(SOCK_DGRAM, options.port);
+  int listener = bind_socket(SOCK_STREAM, options.port);
+  std::cout << "sip_stub on 127.0.0.1:" << options.port << ", REGISTER "
+            << options.register_reply << ", INVITE " << options.invite_reply
+            << ", UDP loss " << options.loss << std::endl;
+
+  std::mt19937 rng(std::random_device{}());
+  std::bernoulli_distribution lost(options.loss);
+  std::map<int, std::string> clients;
+  char buf[65536];
+  for (;;) {
+    std::vector<pollfd> fds = {{udp, POLLIN, 0}, {listener, POLLIN, 0}};
+    for (auto &client : clients) {
+      fds.push_back({client.first, POLLIN, 0});
+    }
+    ::poll(fds.data(), fds.size(), -1);
+
+    if (fds[0].revents & POLLIN) {
+      sockaddr_in peer;
+      socklen_t peer_len = sizeof(peer);
+      auto len = ::recvfrom(udp, buf, sizeof(buf), 0,
+                            reinterpret_cast<sockaddr *>(&peer), &peer_len);
+      if (len > 0 && std::strncmp(buf, "SIP/2.0", 7) != 0 && !lost(rng)) {
+        handle(options, std::string(buf, len), [&](const std::string &msg) {
+          if (!lost(rng)) {
+            ::sendto(udp, msg.data(), msg.size(), 0,
+                     reinterpret_cast<sockaddr *>(&peer), peer_len);
+          }
+        });
+      }
+    }
+    if (fds[1].revents & POLLIN) {
+      int fd = ::accept(listener, nullptr, nullptr);
+      if (fd != -1) {
+        std::cout << "TCP connection " << fd << std::endl;
+        clients[fd];
+      }
+    }
+    for (size_t idx = 2; idx < fds.size(); ++idx) {
+      if (!fds[idx].revents) {
+        continue;
+      }
+      int fd = fds[idx].fd;
+      auto len = ::recv(fd, buf, sizeof(buf), 0);
+      if (len <= 0) {
+        std::cout << "TCP connection " << fd << " closed" << std::endl;
+        ::close(fd);
+        clients.erase(fd);
+        continue;
+      }
+      auto &stream = clients[fd];
+      stream.append(buf, len);
+      std::string msg;
+      while (next_message(stream, msg, fd)) {
+        if (msg.compare(0, 7, "SIP/2.0") == 0) {
+          continue;
+        }
+        handle(options, msg, [&](const std::string &reply) {
+          ::send(fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+        });
+      }
+    }
+  }
+}
+
@@ -0,0 +1,192 @@
+#include "trace.hpp"
+
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+struct Record {
+  std::atomic<uint64_t> timestamp_ns{0};
+  std::atomic<uint64_t> arg{0};
+  std::atomic<uint32_t> span_phase{0};
+};
+
+struct Ring {
+  Ring(size_t capacity, pid_t tid)
+      : records(new Record[capacity]), mask(capacity - 1), tid(tid) {}
+
+  std::unique_ptr<Record[]> records;
+  size_t mask;
+  pid_t tid;
+  std::atomic<uint64_t> head{0};
+};
+
+std::mutex g_rings_mutex;
+std::vector<std::unique_ptr<Ring>> g_rings;
+std::atomic<size_t> g_ring_capacity{0};
+thread_local Ring *t_ring = nullptr;
+
+int g_dump_pipe[2] = {-1, -1};
+
+Ring *ring_for_this_thread() {
+  if (t_ring) {
+    return t_ring;
+  }
+  auto ring = std::make_unique<Ring>(g_ring_capacity.load(),
+                                     static_cast<pid_t>(::syscall(SYS_gettid)));
+  t_ring = ring.get();
+  std::lock_guard<std::mutex> lk(g_rings_mutex);
+  g_rings.push_back(std::move(ring));
+  return t_ring;
+}
+
+const char *span_name(Trace::Span span) {
+  switch (span) {
+  case Trace::Span::StateChange:
+    return "StateChange";
+  case Trace::Span::DialerEvent:
+    return "DialerEvent";
+  case Trace::Span::PlayDigit:
+    return "PlayDigit";
+  case Trace::Span::MakeCall:
+    return "MakeCall";
+  case Trace::Span::CallState:
+    return "CallState";
+  case Trace::Span::CallMediaState:
+    return "CallMediaState";
+  case Trace::Span::RegState:
+    return "RegState";
+  case Trace::Span::IncomingCall:
+    return "IncomingCall";
+  case Trace::Span::GpioIoctl:
+    return "GpioIoctl";
+  case Trace::Span::GpioRead:
+    return "GpioRead";
+  }
+  return "Unknown";
+}
+
+void dump_signal_handler(int) {
+  char ch = 'd';
+  [[maybe_unused]] auto rc = ::write(g_dump_pipe[1], &ch, 1);
+}
+} // namespace
+
+std::atomic<bool> Trace::s_enabled{false};
+
+void Trace::enable(size_t records_per_thread) {
+  size_t capacity = 1;
+  while (capacity < records_per_thread) {
+    capacity <<= 1;
+  }
+  g_ring_capacity.store(capacity);
+  s_enabled.store(true);
+}
+
+void Trace::record(Span span, Phase phase, uint64_t arg) {
+  auto ring = ring_for_this_thread();
+  auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+                 .count();
+  auto head = ring->head.load(std::memory_order_relaxed);
+  auto &rec = ring->records[head & ring->mask];
+  rec.timestamp_ns.store(now, std::memory_order_relaxed);
+  rec.arg.store(arg, std::memory_order_relaxed);
+  rec.span_phase.store(static_cast<uint32_t>(span) << 8 |
+                           static_cast<uint32_t>(phase),
+                       std::memory_order_relaxed);
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Trace::dump_chrome_json(std::ostream &out) {
+  std::lock_guard<std::mutex> lk(g_rings_mutex);
+  auto pid = ::getpid();
+  out << "{\"traceEvents\":[";
+  bool first = true;
+  for (auto &ring : g_rings) {
+    auto capacity = ring->mask + 1;
+    auto head = ring->head.load(std::memory_order_acquire);
+    auto begin = head > capacity ? head - capacity : 0;
+
+    struct Copied {
+      uint64_t timestamp_ns;
+      uint64_t arg;
+      uint32_t span_phase;
+    };
+    std::vector<Copied> copied;
+    copied.reserve(head - begin);
+    for (auto idx = begin; idx < head; ++idx) {
+      auto &rec = ring->records[idx & ring->mask];
+      copied.push_back({rec.timestamp_ns.load(std::memory_order_relaxed),
+                        rec.arg.load(std::memory_order_relaxed),
+                        rec.span_phase.load(std::memory_order_relaxed)});
+    }
+
+    // Anything the owning thread lapped while we were copying is torn, and
+    // so is the slot at new_head, which it may be writing right now.
+    auto new_head = ring->head.load(std::memory_order_acquire);
+    size_t skip = 0;
+    if (new_head + 1 > begin + capacity) {
+      skip = std::min<size_t>(new_head + 1 - capacity - begin, copied.size());
+    }
+
+    for (size_t idx = skip; idx < copied.size(); ++idx) {
+      auto &rec = copied[idx];
+      auto span = static_cast<Span>(rec.span_phase >> 8);
+      auto phase = static_cast<Phase>(rec.span_phase & 0xff);
+      out << (first ? "" : ",") << "\n{\"name\":\"" << span_name(span)
+          << "\",\"ph\":\""
+          << (phase == Phase::Begin ? "B" : phase == Phase::End ? "E" : "i")
+          << "\",\"ts\":" << rec.timestamp_ns / 1000 << "."
+          << (rec.timestamp_ns / 100) % 10 << (rec.timestamp_ns / 10) % 10
+          << rec.timestamp_ns % 10 << ",\"pid\":" << pid
+          << ",\"tid\":" << ring->tid;
+      if (phase == Phase::Instant) {
+        out << ",\"s\":\"t\"";
+      }
+      if (phase != Phase::End) {
+        out << ",\"args\":{\"arg\":" << rec.arg << "}";
+      }
+      out << "}";
+      first = false;
+    }
+  }
+  out << "\n]}\n";
+}
+
+void Trace::install_dump_signal(int signo, std::filesystem::path path) {
+  if (::pipe(g_dump_pipe) == -1) {
+    int err = errno;
+    throw std::system_error(err, std::system_category());
+  }
+
+  std::thread([path = std::move(path)] {
+    for (;;) {
+      char ch;
+      if (::read(g_dump_pipe[0], &ch, 1) != 1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      std::ofstream out(path, std::ios::trunc);
+      dump_chrome_json(out);
+      std::cerr << "*** Trace written to " << path << std::endl;
+    }
+  }).detach();
+
+  struct sigaction action = {};
+  action.sa_handler = dump_signal_handler;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  ::sigaction(signo, &action, nullptr);
+}
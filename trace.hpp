@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+
+// Low overhead event tracing. Each thread appends (timestamp, span, arg)
+// records to its own fixed size ring buffer without taking locks, once its
+// first record has allocated the ring and registered it; the rings can be
+// dumped as Chrome trace JSON (chrome://tracing, Perfetto) at any
+// time, including from a signal. When tracing hasn't been enabled every
+// trace point is a single relaxed atomic load.
+class Trace {
+public:
+  enum class Span : uint16_t {
+    StateChange,
+    DialerEvent,
+    PlayDigit,
+    MakeCall,
+    CallState,
+    CallMediaState,
+    RegState,
+    IncomingCall,
+    GpioIoctl,
+    GpioRead,
+  };
+
+  enum class Phase : uint8_t { Begin, End, Instant };
+
+  class Scope {
+  public:
+    explicit Scope(Span span, uint64_t arg = 0)
+        : m_span(span), m_active(enabled()) {
+      if (m_active) {
+        record(m_span, Phase::Begin, arg);
+      }
+    }
+    ~Scope() {
+      if (m_active) {
+        record(m_span, Phase::End, 0);
+      }
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    Span m_span;
+    bool m_active;
+  };
+
+  static bool enabled() noexcept {
+    return s_enabled.load(std::memory_order_relaxed);
+  }
+
+  static void instant(Span span, uint64_t arg = 0) {
+    if (enabled()) {
+      record(span, Phase::Instant, arg);
+    }
+  }
+
+  // Starts recording; each thread gets a ring of records_per_thread entries
+  // (rounded up to a power of two) the first time it records.
+  static void enable(size_t records_per_thread);
+
+  // Throws std::bad_alloc if this is the thread's first record and its ring
+  // can't be allocated.
+  static void record(Span span, Phase phase, uint64_t arg);
+
+  static void dump_chrome_json(std::ostream &out);
+
+  // Writes a Chrome trace to path every time signo is delivered. The signal
+  // handler only pokes a pipe; the dump happens on a background thread.
+  static void install_dump_signal(int signo, std::filesystem::path path);
+
+private:
+  static std::atomic<bool> s_enabled;
+};
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <yaml-cpp/yaml.h>
 
 #include <pjsua2.hpp>
@@ -38,3 +40,22 @@ public:
 
   std::vector<std::pair<std::string, std::pair<YAML::Node, YAML::Node>>> nodes;
 };
+
+template <typename T> YAML::Node get_defaults() {
+  YamlReader foo({}, "Defaults", {});
+  T obj{};
+  obj.writeObject(foo.get_pj_container_node());
+  return foo.nodes[0].second.first.begin()->second;
+}
+
+template <typename T>
+T read_config_object(YAML::Node config_node, std::string name) {
+  T obj;
+  if (config_node.IsDefined()) {
+    auto default_node = get_defaults<T>();
+    YamlReader reader(std::move(config_node), std::move(name),
+                      std::move(default_node));
+    obj.readObject(reader.get_pj_container_node());
+  }
+  return obj;
+}